@@ -0,0 +1,570 @@
+/*
+ * tc-keyfiles.c
+ *
+ *  Created on: 17.10.2026
+ *      Author: malte
+ *
+ * Prints the default keyfiles of a TrueCrypt or VeraCrypt user, each followed
+ * by a comma, like
+ *
+ *     xpath -s ',' -q -e '/TrueCrypt/defaultkeyfiles/keyfile/text()'
+ *
+ * The result is cached per user until the keyfile list changes.
+ */
+
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE
+#endif
+#include <argp.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+#ifndef CACHE_DIR
+#	define CACHE_DIR "/var/cache/truecrypt-tools"
+#endif
+
+#define KEYFILES_XML "Default Keyfiles.xml"
+
+#define NAME_MAX_LENGTH 64
+
+
+struct buffer {
+	char *data;
+	size_t length, size;
+};
+
+
+static
+struct keyfiles_options {
+	const char *user;
+	bool truecrypt;
+	bool cache;
+}
+keyfiles_options = { NULL, false, true };
+
+
+// forward declarations ===================================
+
+static void buffer_append(struct buffer *b, const char *s, size_t length);
+
+static void buffer_putc(struct buffer *b, int c);
+
+static void buffer_put_utf8(struct buffer *b, unsigned long code_point);
+
+static void veracrypt_dir(const char *home, const char *xdg_config_home, struct buffer *path);
+
+static void config_path(const char *home, struct buffer *path);
+
+static bool parse_keyfiles(FILE *in, struct buffer *out);
+
+static bool skip_past(FILE *in, const char *terminator);
+
+static bool parse_cdata(FILE *in, struct buffer *out);
+
+static void parse_entity(FILE *in, struct buffer *out);
+
+static int read_name(FILE *in, int c, char *name);
+
+static bool read_cache(const char *cache_path, const char *key, struct buffer *out);
+
+static void write_cache(const char *cache_path, const char *key, const struct buffer *value);
+
+
+// implementation =========================================
+
+void buffer_append(struct buffer *b, const char *s, size_t length)
+{
+	if (b->length + length >= b->size) {
+		size_t size = b->size ? b->size : 256;
+		char *data;
+		while (b->length + length >= size)
+			size *= 2;
+		if (!(data = realloc(b->data, size)))
+			err(EXIT_FAILURE, "malloc");
+		b->data = data;
+		b->size = size;
+	}
+	memcpy(b->data + b->length, s, length);
+	b->length += length;
+	b->data[b->length] = '\0';
+}
+
+
+void buffer_putc(struct buffer *b, int c)
+{
+	const char c_ = (char) c;
+	buffer_append(b, &c_, 1);
+}
+
+
+void buffer_put_utf8(struct buffer *b, unsigned long cp)
+{
+	char s[4];
+	size_t n;
+
+	if (cp < 0x80) {
+		s[0] = (char) cp;
+		n = 1;
+	} else if (cp < 0x800) {
+		s[0] = (char)(0xc0 | cp >> 6);
+		s[1] = (char)(0x80 | (cp & 0x3f));
+		n = 2;
+	} else if (cp < 0x10000) {
+		s[0] = (char)(0xe0 | cp >> 12);
+		s[1] = (char)(0x80 | (cp >> 6 & 0x3f));
+		s[2] = (char)(0x80 | (cp & 0x3f));
+		n = 3;
+	} else {
+		s[0] = (char)(0xf0 | cp >> 18);
+		s[1] = (char)(0x80 | (cp >> 12 & 0x3f));
+		s[2] = (char)(0x80 | (cp >> 6 & 0x3f));
+		s[3] = (char)(0x80 | (cp & 0x3f));
+		n = 4;
+	}
+	buffer_append(b, s, n);
+}
+
+
+void veracrypt_dir(const char *home, const char *xdg_config_home, struct buffer *path)
+{
+	if (xdg_config_home && xdg_config_home[0] == '/') {
+		buffer_append(path, xdg_config_home, strlen(xdg_config_home));
+	} else {
+		buffer_append(path, home, strlen(home));
+		buffer_append(path, "/.config", 8);
+	}
+	buffer_append(path, "/VeraCrypt/", 11);
+}
+
+
+/*
+ * Finds the keyfile list in the configuration directory that TrueCrypt or
+ * VeraCrypt would use for a user with the given home directory.
+ */
+void config_path(const char *home, struct buffer *path)
+{
+	static const char configuration[] = "Configuration.xml";
+	const char *xdg_config_home = keyfiles_options.user ? NULL : getenv("XDG_CONFIG_HOME");
+	struct stat st;
+
+	path->length = 0;
+	if (keyfiles_options.truecrypt) {
+		buffer_append(path, home, strlen(home));
+		buffer_append(path, "/.TrueCrypt/", 12);
+	} else {
+		veracrypt_dir(home, xdg_config_home, path);
+		buffer_append(path, configuration, sizeof(configuration) - 1);
+
+		// VeraCrypt keeps using the legacy directory if it holds a configuration
+		if (stat(path->data, &st) != 0) {
+			path->length = 0;
+			buffer_append(path, home, strlen(home));
+			buffer_append(path, "/.VeraCrypt/", 12);
+			buffer_append(path, configuration, sizeof(configuration) - 1);
+			if (stat(path->data, &st) != 0) {
+				path->length = 0;
+				veracrypt_dir(home, xdg_config_home, path);
+				buffer_append(path, configuration, sizeof(configuration) - 1);
+			}
+		}
+		path->length -= sizeof(configuration) - 1;
+	}
+
+	buffer_append(path, KEYFILES_XML, sizeof(KEYFILES_XML) - 1);
+}
+
+
+/*
+ * Appends the text of every /TrueCrypt/defaultkeyfiles/keyfile element
+ * (/VeraCrypt/... works as well) to out, each followed by a comma. This is no
+ * validating XML parser; it only understands as much as the keyfile lists of
+ * TrueCrypt and VeraCrypt use. Returns false for truncated documents.
+ */
+bool parse_keyfiles(FILE *in, struct buffer *out)
+{
+	static const char *const path[][2] = {
+		{ "TrueCrypt", "VeraCrypt" },
+		{ "defaultkeyfiles", NULL },
+		{ "keyfile", NULL }
+	};
+	const size_t keyfile_depth = sizeof(path) / sizeof(*path);
+	char name[NAME_MAX_LENGTH + 1];
+	size_t depth = 0, matched = 0, text_start = 0;
+	int c, quote;
+
+	while ((c = getc(in)) != EOF) {
+		const bool in_keyfile = depth == keyfile_depth && matched == keyfile_depth;
+
+		if (c != '<') {
+			if (in_keyfile) {
+				if (c == '&') {
+					parse_entity(in, out);
+				} else {
+					buffer_putc(out, c);
+				}
+			}
+			continue;
+		}
+
+		switch (c = getc(in)) {
+			case '?':
+				if (!skip_past(in, "?>"))
+					return false;
+				break;
+
+			case '!':
+				if ((c = getc(in)) == '-') {
+					if (getc(in) != '-' || !skip_past(in, "-->"))
+						return false;
+				} else if (c == '[') {
+					// <![CDATA[...]]>
+					if (!skip_past(in, "[") || !parse_cdata(in, in_keyfile ? out : NULL))
+						return false;
+				} else if (c == EOF || !skip_past(in, ">")) {
+					return false;
+				}
+				break;
+
+			case '/':
+				if ((c = read_name(in, getc(in), name)) == EOF ||
+					(c != '>' && !skip_past(in, ">")) || !depth)
+				{
+					return false;
+				}
+				if (in_keyfile && out->length > text_start)
+					buffer_putc(out, ',');
+				depth--;
+				if (matched > depth)
+					matched = depth;
+				break;
+
+			default:
+				if ((c = read_name(in, c, name)) == EOF)
+					return false;
+				if (depth < keyfile_depth && matched == depth && (
+						strcmp(name, path[depth][0]) == 0 ||
+						(path[depth][1] && strcmp(name, path[depth][1]) == 0)
+				)) {
+					matched++;
+				}
+				depth++;
+
+				// skip the attributes and notice empty elements
+				for (quote = 0; c != '>'; c = getc(in)) {
+					if (c == EOF)
+						return false;
+					if (quote) {
+						if (c == quote)
+							quote = 0;
+					} else if (c == '"' || c == '\'') {
+						quote = c;
+					} else if (c == '/') {
+						depth--;
+						if (matched > depth)
+							matched = depth;
+					}
+				}
+				text_start = out->length;
+				break;
+		}
+	}
+
+	return depth == 0;
+}
+
+
+/*
+ * Reads up to and including the next occurrence of terminator.
+ */
+bool skip_past(FILE *in, const char *terminator)
+{
+	const size_t length = strlen(terminator);
+	size_t matched = 0;
+	int c;
+
+	while (matched < length && (c = getc(in)) != EOF) {
+		if (c == terminator[matched]) {
+			matched++;
+		} else {
+			// good enough for the terminators we use
+			matched = (c == terminator[0]) ? 1 : 0;
+		}
+	}
+	return matched == length;
+}
+
+
+/*
+ * Reads the content of a CDATA section up to and including "]]>" and appends
+ * it to out unless that is NULL.
+ */
+bool parse_cdata(FILE *in, struct buffer *out)
+{
+	size_t brackets = 0;
+	bool end;
+	int c;
+
+	while ((c = getc(in)) != EOF) {
+		if (c == ']') {
+			brackets++;
+			continue;
+		}
+
+		if ((end = c == '>' && brackets >= 2))
+			brackets -= 2;
+		for (; brackets; brackets--) {
+			if (out) buffer_putc(out, ']');
+		}
+		if (end)
+			return true;
+		if (out)
+			buffer_putc(out, c);
+	}
+	return false;
+}
+
+
+/*
+ * Decodes the entity after '&'. Unknown entities are kept as they are.
+ */
+void parse_entity(FILE *in, struct buffer *out)
+{
+	static const struct entity {
+		const char *name, *value;
+	} entities[] = {
+		{ "amp", "&" }, { "lt", "<" }, { "gt", ">" }, { "quot", "\"" }, { "apos", "'" }
+	};
+	const struct entity *e;
+	char name[16], *end;
+	unsigned long code_point;
+	size_t length = 0;
+	int c;
+
+	while ((c = getc(in)) != EOF && c != ';' && length < sizeof(name) - 1)
+		name[length++] = (char) c;
+	name[length] = '\0';
+
+	if (c == ';') {
+		if (name[0] == '#') {
+			code_point = (name[1] == 'x') ?
+				strtoul(name + 2, &end, 16) :
+				strtoul(name + 1, &end, 10);
+			if (!*end && end != name + 1 && code_point && code_point <= 0x10ffff) {
+				buffer_put_utf8(out, code_point);
+				return;
+			}
+		} else {
+			for (e = entities; e != entities + sizeof(entities) / sizeof(*entities); e++) {
+				if (strcmp(name, e->name) == 0) {
+					buffer_append(out, e->value, strlen(e->value));
+					return;
+				}
+			}
+		}
+	}
+
+	buffer_putc(out, '&');
+	buffer_append(out, name, length);
+	if (c != EOF)
+		buffer_putc(out, c);
+}
+
+
+/*
+ * Reads an element name starting with c into name and returns the character
+ * after it. Overlong names are truncated, which is fine since we're only
+ * looking for short ones.
+ */
+int read_name(FILE *in, int c, char *name)
+{
+	size_t length = 0;
+	for (; c != EOF && !strchr(" \t\r\n/>", c); c = getc(in)) {
+		if (length < NAME_MAX_LENGTH)
+			name[length++] = (char) c;
+	}
+	name[length] = '\0';
+	return c;
+}
+
+
+/*
+ * Appends the cached value to out if the cache file belongs to us and starts
+ * with key.
+ */
+bool read_cache(const char *cache_path, const char *key, struct buffer *out)
+{
+	const size_t key_length = strlen(key);
+	struct buffer content = { NULL, 0, 0 };
+	struct stat st;
+	char buf[4096];
+	ssize_t n;
+	bool hit = false;
+	int fd;
+
+	if ((fd = open(cache_path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC)) < 0)
+		return false;
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+		st.st_uid == geteuid() && !(st.st_mode & (S_IWGRP | S_IWOTH)))
+	{
+		while ((n = read(fd, buf, sizeof(buf))) > 0)
+			buffer_append(&content, buf, (size_t) n);
+		if (n == 0 && content.length >= key_length && memcmp(content.data, key, key_length) == 0) {
+			buffer_append(out, content.data + key_length, content.length - key_length);
+			hit = true;
+		}
+	}
+
+	close(fd);
+	free(content.data);
+	return hit;
+}
+
+
+/*
+ * Replaces the cache file atomically. The cache is only an optimisation, so
+ * failures are ignored.
+ */
+void write_cache(const char *cache_path, const char *key, const struct buffer *value)
+{
+	char *temp_path;
+	FILE *f;
+	int fd;
+
+	if (mkdir(CACHE_DIR, 0700) != 0 && errno != EEXIST)
+		return;
+	if (asprintf(&temp_path, "%s.XXXXXX", cache_path) < 0)
+		return;
+
+	if ((fd = mkstemp(temp_path)) >= 0) {
+		if ((f = fdopen(fd, "w"))) {
+			fputs(key, f);
+			fwrite(value->data, 1, value->length, f);
+			if (fclose(f) == 0 && rename(temp_path, cache_path) == 0) {
+				free(temp_path);
+				return;
+			}
+		} else {
+			close(fd);
+		}
+		unlink(temp_path);
+	}
+	free(temp_path);
+}
+
+
+static int parse_option(int key, char *arg, struct argp_state *state)
+{
+	switch (key) {
+	case 'T':
+		keyfiles_options.truecrypt = true;
+		break;
+
+	case 'n':
+		keyfiles_options.cache = false;
+		break;
+
+	case ARGP_KEY_ARG:
+		if (keyfiles_options.user)
+			argp_error(state, "Too many arguments.");
+		keyfiles_options.user = arg;
+		break;
+
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+
+	return 0;
+}
+
+
+static struct argp_option const argp_options[] = {
+	{ "truecrypt", 'T', NULL, 0,
+		"Look in the configuration directory of TrueCrypt instead of VeraCrypt.", 0 },
+	{ "no-cache", 'n', NULL, 0,
+		"Neither use nor update the cache in " CACHE_DIR ".", 0 },
+	{ 0 }
+};
+
+static struct argp const argp = {
+	argp_options, &parse_option,
+	"[USER]",
+	"Prints the default keyfiles of USER (or the user in HOME), each followed by "
+	"a comma.\v"
+	"The keyfile list is cached per user until its modification time, inode, or "
+	"size change.",
+	NULL, NULL, NULL
+};
+
+
+int main(int argc, char *argv[])
+{
+	struct buffer path = { NULL, 0, 0 }, keyfiles = { NULL, 0, 0 };
+	const struct passwd *pw;
+	const char *home;
+	char *key = NULL, *cache_path = NULL;
+	struct stat st;
+	uid_t uid;
+	FILE *f;
+	bool cached = false;
+
+	argp_parse(&argp, argc, argv, 0, NULL, NULL);
+
+	if (keyfiles_options.user) {
+		if (!(pw = getpwnam(keyfiles_options.user)))
+			errx(EXIT_FAILURE, "Unknown user '%s'.", keyfiles_options.user);
+		home = pw->pw_dir;
+		uid = pw->pw_uid;
+	} else {
+		home = getenv("HOME");
+		uid = getuid();
+	}
+	if (!home || home[0] != '/')
+		errx(EXIT_FAILURE, "The home directory isn't an absolute path.");
+
+	config_path(home, &path);
+	if (!(f = fopen(path.data, "re"))) {
+		// no default keyfiles
+		free(path.data);
+		return EXIT_SUCCESS;
+	}
+
+	if (keyfiles_options.cache) {
+		if (fstat(fileno(f), &st) != 0)
+			err(EXIT_FAILURE, "%s", path.data);
+		if (asprintf(&key, "%ju:%ju %jd %jd.%09ld %s\n",
+				(uintmax_t) st.st_dev, (uintmax_t) st.st_ino, (intmax_t) st.st_size,
+				(intmax_t) st.st_mtim.tv_sec, st.st_mtim.tv_nsec, path.data) < 0 ||
+			asprintf(&cache_path, CACHE_DIR "/default-keyfiles.%ju", (uintmax_t) uid) < 0)
+		{
+			err(EXIT_FAILURE, "malloc");
+		}
+		cached = read_cache(cache_path, key, &keyfiles);
+	}
+
+	if (!cached) {
+		if (!parse_keyfiles(f, &keyfiles))
+			errx(EXIT_FAILURE, "%s: %s", path.data, ferror(f) ? strerror(errno) : "Malformed XML");
+		if (keyfiles_options.cache)
+			write_cache(cache_path, key, &keyfiles);
+	}
+	fclose(f);
+
+	fwrite(keyfiles.data ? keyfiles.data : "", 1, keyfiles.length, stdout);
+
+	free(keyfiles.data);
+	free(path.data);
+	free(key);
+	free(cache_path);
+	return (fflush(stdout) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -27,8 +27,6 @@ static char *argtype_to_conversion_specifier(enum argument_type type, char *fmt)
 
 static bool argument_check_validity(const struct argp_action *action);
 
-static int parse_period(const char *s, long *period);
-
 
 // implementation =========================================
 
@@ -136,8 +134,8 @@ int argp_handle_argument_parse(
 		break;
 
 	default:
-		assert(false);
-		return EINVAL;
+		// the number didn't parse
+		break;
 	}
 
 	argp_error(state, "'%s' is an invalid argument to option '%s' because \"%s\".",
@@ -240,19 +238,26 @@ inline int return_error(error_t e)
 	return -1;
 }
 
+/*
+ * Parses a period like "1h30m", "2.5s" or "1500ms" into milliseconds. Each
+ * number may have a decimal fraction. A number without a unit means seconds
+ * and must come last.
+ */
 int parse_period(const char *s, long *period_)
 {
-	static const char units[] = { 'w', 'd', 'h', 'm', 's', '\0' };
+	static const char *const units[] = { "w", "d", "h", "m", "s", "ms" };
 	static const unsigned long factors[] = {
-		60 * 60 * 24 * 7,
-		60 * 60 * 24,
-		60 * 60,
-		60,
-		1, 1
+		1000UL * 60 * 60 * 24 * 7,
+		1000UL * 60 * 60 * 24,
+		1000UL * 60 * 60,
+		1000UL * 60,
+		1000UL,
+		1
 	};
 
-	unsigned long period = 0, n;
-	const char *unit, *last_unit = NULL;
+	unsigned long period = 0, n, scale;
+	const char *const *unit, *const *last_unit = NULL, *fraction, *unit_name;
+	size_t unit_length, unit_name_length;
 	int c;
 	bool negative;
 
@@ -261,19 +266,40 @@ int parse_period(const char *s, long *period_)
 	if ((negative = (*s == '-')) || *s == '+')
 		s++;
 
-	for (; sscanf(s, "%lu%n", &n, &c) > 0; s += c + 1) {
-		unit = memchr(units, s[c], elementsof(units));
-		if (unit <= last_unit)
+	while (inrange(*s, '0', '9' + 1) && sscanf(s, "%lu%n", &n, &c) > 0) {
+		s += c;
+		fraction = NULL;
+		if (*s == '.') {
+			fraction = ++s;
+			s += strspn(s, "0123456789");
+		}
+
+		unit_length = strspn(s, "abcdefghijklmnopqrstuvwxyz");
+		unit_name = unit_length ? s : "s";
+		unit_name_length = unit_length ? unit_length : 1;
+		for (unit = units; unit != array_end(units); unit++) {
+			if (strlen(*unit) == unit_name_length && !strncmp(unit_name, *unit, unit_name_length))
+				break;
+		}
+		if (unit == array_end(units) || unit <= last_unit)
 			return return_error(EINVAL);
 		last_unit = unit;
 
-		if (!mul_ul_checked(n, factors[unit - units], &n))
+		if (!mul_ul_checked(n, factors[unit - units], &n) ||
+			!add_ul_checked(period, n, &period)
+		) {
 			return return_error(ERANGE);
+		}
 
-		if (!add_ul_checked(period, n, &period))
-			return return_error(ERANGE);
+		// fractions of a millisecond are truncated
+		for (scale = factors[unit - units]; fraction && inrange(*fraction, '0', '9' + 1); fraction++) {
+			scale /= 10;
+			if (!add_ul_checked(period, (unsigned long)(*fraction - '0') * scale, &period))
+				return return_error(ERANGE);
+		}
 
-		if (!s[c] || s[c] == 's') {
+		s += unit_length;
+		if (!*s) {
 			if (negative) {
 				if (period > (unsigned long) LONG_MAX + 1)
 					return return_error(ERANGE);
@@ -285,8 +311,9 @@ int parse_period(const char *s, long *period_)
 			}
 			return 0;
 		}
+		if (!unit_length)
+			break;
 	}
 
-	assert(errno != EINVAL);
-	return -1;
+	return return_error(EINVAL);
 }
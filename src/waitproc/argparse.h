@@ -103,4 +103,7 @@ error_t argp_handle_argument(
 error_t argp_action_wrapper(int key, char *arg, struct argp_state *state);
 
 
+int parse_period(const char *s, long *period);
+
+
 #endif /* ARGPARSE_H_ */
@@ -0,0 +1,479 @@
+/*
+ * waitproc-bench.c
+ *
+ *  Created on: 17.10.2026
+ *      Author: malte
+ *
+ * Spawns populations of fixture processes, runs waitproc against them and
+ * reports how long it took to attach to and signal them all, how long until
+ * the last of them exited, and how much CPU time waitproc used.
+ */
+
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE
+#endif
+#include <argp.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "../utils.h"
+
+
+#define FIXTURE_THREADS 4
+
+// tasks to leave for the rest of the system
+#define TASK_HEADROOM 1000
+
+
+enum fixture_kind {
+	FIXTURE_TERM,
+	FIXTURE_IGNORE,
+	FIXTURE_FORK,
+	FIXTURE_SLOW,
+	FIXTURE_THREADS_,
+	_FIXTURE_COUNT,
+	FIXTURE_MIX = _FIXTURE_COUNT
+};
+
+static const char *const fixture_names[] = {
+	"term", "ignore", "fork", "slow", "threads", "mix"
+};
+
+
+/* Lives in memory shared with the fixtures. */
+struct fixture_slot {
+	struct timespec signalled, exited;
+};
+
+struct shared_state {
+	unsigned long ready;
+	struct fixture_slot slots[];
+};
+
+
+static
+struct bench_options {
+	const char *waitproc;
+	char *waitproc_args;
+	enum fixture_kind kind;
+	unsigned long *sizes;
+	size_t size_count;
+}
+bench_options = {
+	"./waitproc",
+	"-q --schedule TERM,KILL@1s -i 5s",
+	FIXTURE_MIX,
+	NULL, 0
+};
+
+
+static struct shared_state *shared;
+static struct fixture_slot *fixture_slot;
+static enum fixture_kind fixture_kind;
+
+
+// fixtures ===============================================
+
+static void fixture_exit(int status)
+{
+	clock_gettime(CLOCK_MONOTONIC, &fixture_slot->exited);
+	_exit(status);
+}
+
+
+static void fixture_handle_signal(int signal)
+{
+	struct timespec ts = { 0, 200 * 1000000L };
+	pid_t child;
+
+	if (timespec_iszero(&fixture_slot->signalled))
+		clock_gettime(CLOCK_MONOTONIC, &fixture_slot->signalled);
+
+	switch (fixture_kind) {
+		case FIXTURE_IGNORE:
+			return;
+
+		case FIXTURE_FORK:
+			if ((child = fork()) == 0) {
+				ts.tv_nsec = 50 * 1000000L;
+				nanosleep(&ts, NULL);
+				_exit(0);
+			}
+			if (child > 0)
+				waitpid(child, NULL, 0);
+			break;
+
+		case FIXTURE_SLOW:
+			nanosleep(&ts, NULL);
+			break;
+
+		default:
+			break;
+	}
+
+	fixture_exit(128 + signal);
+}
+
+
+static void *fixture_thread(void *unused)
+{
+	(void) unused;
+	for (;;)
+		pause();
+	return NULL;
+}
+
+
+static void run_fixture(enum fixture_kind kind, struct fixture_slot *slot)
+{
+	struct sigaction action;
+	pthread_t thread;
+	int i;
+
+	fixture_kind = kind;
+	fixture_slot = slot;
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = &fixture_handle_signal;
+	sigaction(SIGHUP, &action, NULL);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	if (kind == FIXTURE_THREADS_) {
+		for (i = 0; i < FIXTURE_THREADS; i++)
+			pthread_create(&thread, NULL, &fixture_thread, NULL);
+	}
+
+	__atomic_add_fetch(&shared->ready, 1, __ATOMIC_RELEASE);
+	for (;;)
+		pause();
+}
+
+
+// driver =================================================
+
+static pid_t spawn_waitproc(const pid_t *pids, unsigned long count, const char *stats_path)
+{
+	char **argv, *args, *arg, *saveptr;
+	size_t argc = 0, i;
+	pid_t pid;
+
+	if (!(args = strdup(bench_options.waitproc_args)) ||
+		!(argv = malloc((strlen(args) / 2 + 5 + count) * sizeof(*argv))))
+	{
+		err(EXIT_FAILURE, "malloc");
+	}
+
+	argv[argc++] = (char*) bench_options.waitproc;
+	for (arg = strtok_r(args, " ", &saveptr); arg; arg = strtok_r(NULL, " ", &saveptr))
+		argv[argc++] = arg;
+	argv[argc++] = "--stats";
+	argv[argc++] = (char*) stats_path;
+	for (i = 0; i < count; i++) {
+		if (asprintf(&argv[argc++], "%i", pids[i]) < 0)
+			err(EXIT_FAILURE, "malloc");
+	}
+	argv[argc] = NULL;
+
+	if ((pid = fork()) == 0) {
+		execv(argv[0], argv);
+		err(127, "%s", argv[0]);
+	}
+
+	for (i = argc - count; i < argc; i++)
+		free(argv[i]);
+	free(argv);
+	free(args);
+	return pid;
+}
+
+
+/*
+ * Returns how many tasks a population of count fixtures needs, counting the
+ * threads and the children of forking fixtures.
+ */
+static unsigned long fixture_tasks(enum fixture_kind kind, unsigned long count)
+{
+	unsigned long tasks = 0;
+	int k;
+
+	if (kind == FIXTURE_MIX) {
+		for (k = 0; k < _FIXTURE_COUNT; k++)
+			tasks += fixture_tasks((enum fixture_kind) k, count / _FIXTURE_COUNT + 1);
+		return tasks;
+	}
+	return count * (
+		(kind == FIXTURE_THREADS_) ? 1 + FIXTURE_THREADS :
+		(kind == FIXTURE_FORK) ? 2 :
+		1);
+}
+
+
+static unsigned long read_ulong(const char *path)
+{
+	unsigned long n = ULONG_MAX;
+	FILE *f = fopen(path, "r");
+	if (f) {
+		if (fscanf(f, "%lu", &n) != 1)
+			n = ULONG_MAX;
+		fclose(f);
+	}
+	return n;
+}
+
+
+/*
+ * Returns how many more tasks the system takes, judging by threads-max,
+ * pid_max and the tasks in /proc/loadavg, or ULONG_MAX if unknown.
+ */
+static unsigned long task_capacity(void)
+{
+	const unsigned long limit = min(read_ulong("/proc/sys/kernel/threads-max"),
+		read_ulong("/proc/sys/kernel/pid_max"));
+	unsigned long tasks;
+	FILE *f;
+
+	if (limit == ULONG_MAX || !(f = fopen("/proc/loadavg", "r")))
+		return ULONG_MAX;
+	if (fscanf(f, "%*s %*s %*s %*u/%lu", &tasks) != 1)
+		tasks = 0;
+	fclose(f);
+	return (limit > tasks + TASK_HEADROOM) ? limit - tasks - TASK_HEADROOM : 0;
+}
+
+
+/*
+ * Returns the time from the start of waitproc until it attached to the last
+ * fixture, from the attach_ms fields of its --stats document, or -1.
+ */
+static double read_attach_ms(const char *stats_path)
+{
+	static const char field[] = "\"attach_ms\": ";
+	double attach_ms = -1, t;
+	char *buf = NULL, *s, *end;
+	size_t size = 0;
+	FILE *f;
+
+	if (!(f = fopen(stats_path, "r")))
+		return -1;
+	if (getdelim(&buf, &size, '\0', f) > 0) {
+		for (s = buf; (s = strstr(s, field)); s = end) {
+			// the histogram of the same name and null don't parse
+			s += sizeof(field) - 1;
+			t = strtod(s, &end);
+			if (end != s && t > attach_ms)
+				attach_ms = t;
+			else
+				end = s;
+		}
+	}
+	free(buf);
+	fclose(f);
+	return attach_ms;
+}
+
+
+static double ms_since(const struct timespec *t, const struct timespec *start)
+{
+	return timespec_iszero(t) ? -1 : timespec_subtract(t, start) * 1e3;
+}
+
+
+static double timeval_ms(const struct timeval *t)
+{
+	return (double) t->tv_sec * 1e3 + (double) t->tv_usec * 1e-3;
+}
+
+
+/*
+ * Runs one benchmark round with count fixtures and prints a line of results.
+ * Skips populations that the system has no room for. Returns false if the
+ * population couldn't be spawned.
+ */
+static bool bench_round(unsigned long count)
+{
+	const size_t shared_size = sizeof(*shared) + count * sizeof(*shared->slots);
+	const unsigned long tasks = fixture_tasks(bench_options.kind, count),
+		capacity = task_capacity();
+	char stats_path[] = "/tmp/waitproc-bench.XXXXXX";
+	struct timespec start, end, pause_ts = { 0, 1000000L };
+	struct rusage usage;
+	pid_t *pids, waitproc;
+	unsigned long i, spawned;
+	double signal_ms = -1, exit_ms = -1, t;
+	int status, fd;
+	bool complete;
+
+	if (tasks > capacity) {
+		warnx("Skipping %lu %s fixtures: they need %lu tasks, but only %lu are left.",
+			count, fixture_names[bench_options.kind], tasks, capacity);
+		return true;
+	}
+
+	shared = mmap(NULL, shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED || !(pids = malloc(count * sizeof(*pids))))
+		err(EXIT_FAILURE, "malloc");
+
+	for (spawned = 0; spawned < count; spawned++) {
+		enum fixture_kind kind = (bench_options.kind == FIXTURE_MIX) ?
+			(enum fixture_kind)(spawned % _FIXTURE_COUNT) :
+			bench_options.kind;
+		if ((pids[spawned] = fork()) == 0) {
+			run_fixture(kind, &shared->slots[spawned]);
+		} else if (pids[spawned] < 0) {
+			warn("Spawning fixture %lu of %lu", spawned + 1, count);
+			break;
+		}
+	}
+
+	complete = spawned == count;
+	while (__atomic_load_n(&shared->ready, __ATOMIC_ACQUIRE) < spawned)
+		nanosleep(&pause_ts, NULL);
+
+	if (complete) {
+		if ((fd = mkstemp(stats_path)) < 0)
+			err(EXIT_FAILURE, "%s", stats_path);
+		close(fd);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		waitproc = spawn_waitproc(pids, count, stats_path);
+		if (waitproc < 0 || wait4(waitproc, &status, 0, &usage) < 0)
+			err(EXIT_FAILURE, "%s", bench_options.waitproc);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+	}
+
+	// clean up the stragglers before looking at the results
+	for (i = 0; i < spawned; i++)
+		kill(pids[i], SIGKILL);
+	for (i = 0; i < spawned; i++)
+		waitpid(pids[i], NULL, 0);
+
+	if (complete) {
+		for (i = 0; i < count; i++) {
+			if ((t = ms_since(&shared->slots[i].signalled, &start)) > signal_ms)
+				signal_ms = t;
+			if ((t = ms_since(&shared->slots[i].exited, &start)) > exit_ms)
+				exit_ms = t;
+		}
+
+		printf("%-8s %7lu %11.3f %11.3f %13.3f %13.3f %9.3f %7i\n",
+			fixture_names[bench_options.kind], count,
+			read_attach_ms(stats_path), signal_ms, exit_ms, timespec_subtract(&end, &start) * 1e3,
+			timeval_ms(&usage.ru_utime) + timeval_ms(&usage.ru_stime),
+			WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+		fflush(stdout);
+		unlink(stats_path);
+	}
+
+	free(pids);
+	munmap(shared, shared_size);
+	return complete;
+}
+
+
+static int parse_option(int key, char *arg, struct argp_state *state)
+{
+	unsigned long size, *sizes;
+	char *end;
+	int i;
+
+	switch (key) {
+	case 'w':
+		bench_options.waitproc = arg;
+		break;
+
+	case 'a':
+		bench_options.waitproc_args = arg;
+		break;
+
+	case 'k':
+		for (i = 0; i <= FIXTURE_MIX && strcmp(arg, fixture_names[i]); i++)
+			;
+		if (i > FIXTURE_MIX)
+			argp_error(state, "Unknown fixture kind '%s'.", arg);
+		bench_options.kind = (enum fixture_kind) i;
+		break;
+
+	case ARGP_KEY_ARG:
+		size = strtoul(arg, &end, 10);
+		if (*end || !size)
+			argp_error(state, "'%s' is not a positive population size.", arg);
+		if (!(sizes = realloc(bench_options.sizes, (bench_options.size_count + 1) * sizeof(*sizes))))
+			err(EXIT_FAILURE, "malloc");
+		bench_options.sizes = sizes;
+		sizes[bench_options.size_count++] = size;
+		break;
+
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+
+	return 0;
+}
+
+
+static struct argp_option const argp_options[] = {
+	{ "waitproc", 'w', "PATH", 0,
+		"The waitproc executable to measure (default: ./waitproc).", 0 },
+	{ "args", 'a', "ARGS", 0,
+		"Space-separated waitproc options preceding the PIDs "
+		"(default: \"-q --schedule TERM,KILL@1s -i 5s\").", 0 },
+	{ "kind", 'k', "KIND", 0,
+		"The kind of fixture processes: term (exit on SIGTERM), ignore (ignore "
+		"SIGTERM), fork (fork a child before exiting), slow (take 200 ms to "
+		"exit), threads (run 4 threads), or mix (all of them in equal "
+		"shares; the default).", 0 },
+	{ 0 }
+};
+
+static struct argp const argp = {
+	argp_options, &parse_option,
+	"SIZE...",
+	"Runs waitproc against populations of SIZE fixture processes each and "
+	"prints a line per population with the time until waitproc attached to the "
+	"last fixture (attach_ms, from its --stats and measured from its own start), "
+	"the time until the last fixture received a signal (signal_ms), the time "
+	"until the last fixture exited on its own (last_exit_ms), the time until "
+	"waitproc exited (waitproc_ms), and the CPU time waitproc used (cpu_ms). "
+	"The other times are in milliseconds from the spawning of waitproc. "
+	"Populations that would exceed threads-max or pid_max are skipped.",
+	NULL, NULL, NULL
+};
+
+
+int main(int argc, char *argv[])
+{
+	struct rlimit limit;
+	size_t i;
+	int result = EXIT_SUCCESS;
+
+	argp_parse(&argp, argc, argv, 0, NULL, NULL);
+	if (!bench_options.size_count)
+		errx(EXIT_FAILURE, "No population sizes given.");
+
+	if (getrlimit(RLIMIT_NPROC, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NPROC, &limit);
+	}
+
+	printf("%-8s %7s %11s %11s %13s %13s %9s %7s\n",
+		"kind", "procs", "attach_ms", "signal_ms", "last_exit_ms", "waitproc_ms", "cpu_ms", "status");
+	for (i = 0; i < bench_options.size_count; i++) {
+		if (!bench_round(bench_options.sizes[i]))
+			result = EXIT_FAILURE;
+	}
+
+	free(bench_options.sizes);
+	return result;
+}
@@ -0,0 +1,308 @@
+/*
+ * cgroup.c
+ *
+ *  Created on: 17.10.2026
+ *      Author: malte
+ */
+
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE
+#endif
+#include "cgroup.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "utils.h"
+
+
+// how long to wait for a freeze to take effect before signalling anyway
+#ifndef CGROUP_FREEZE_TIMEOUT_MS
+#	define CGROUP_FREEZE_TIMEOUT_MS 100
+#endif
+
+
+// forward declarations ===================================
+
+static char *cgroup2_mount_point(void);
+
+static int read_events(const struct cgroup *c, bool *populated, bool *frozen);
+
+static int read_control(int dir_fd, const char *name, char *buf, size_t size);
+
+static int write_control(int dir_fd, const char *name, const char *value);
+
+static void wait_frozen(const struct cgroup *c);
+
+static long signal_processes(int dir_fd, int signal);
+
+
+// implementation =========================================
+
+bool a_cgroup_push(struct a_cgroup *a, const char *path)
+{
+	struct cgroup *c;
+	char *mount_point;
+
+	if (a->length >= a->size) {
+		size_t size = a->size ? a->size * 2 : 4;
+		if (!(c = realloc(a->values, size * sizeof(*c))))
+			return false;
+		a->values = c;
+		a->size = size;
+	}
+
+	c = &a->values[a->length];
+	if (path[0] == '/') {
+		c->path = strdup(path);
+	} else {
+		if (!(mount_point = cgroup2_mount_point())) {
+			errno = ENOENT;
+			return false;
+		}
+		if (asprintf(&c->path, "%s/%s", mount_point, path) < 0)
+			c->path = NULL;
+		free(mount_point);
+	}
+	if (!c->path)
+		return false;
+
+	c->dir_fd = c->events_fd = -1;
+	c->populated = false;
+	a->length++;
+	return true;
+}
+
+
+void a_cgroup_free(struct a_cgroup *a)
+{
+	struct cgroup *c;
+	for (c = a->values; c != a->values + a->length; c++) {
+		cgroup_close(c);
+		free(c->path);
+	}
+	free(a->values);
+	memset(a, 0, sizeof(*a));
+}
+
+
+bool cgroup_open(struct cgroup *c)
+{
+	if ((c->dir_fd = open(c->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0 ||
+		(c->events_fd = openat(c->dir_fd, "cgroup.events", O_RDONLY | O_CLOEXEC)) < 0 ||
+		cgroup_update(c) < 0)
+	{
+		cgroup_close(c);
+		return false;
+	}
+	return true;
+}
+
+
+void cgroup_close(struct cgroup *c)
+{
+	if (c->events_fd >= 0) {
+		close(c->events_fd);
+		c->events_fd = -1;
+	}
+	if (c->dir_fd >= 0) {
+		close(c->dir_fd);
+		c->dir_fd = -1;
+	}
+}
+
+
+int cgroup_update(struct cgroup *c)
+{
+	bool frozen;
+	return read_events(c, &c->populated, &frozen);
+}
+
+
+long cgroup_signal(struct cgroup *c, int signal)
+{
+	char freeze[4];
+	bool thaw = false;
+	long count;
+	int error;
+
+	if (signal == SIGKILL && write_control(c->dir_fd, "cgroup.kill", "1") == 0)
+		return 1;
+
+	// leave groups alone that somebody else froze
+	if (read_control(c->dir_fd, "cgroup.freeze", freeze, sizeof(freeze)) == 0 && freeze[0] == '0' &&
+		write_control(c->dir_fd, "cgroup.freeze", "1") == 0)
+	{
+		thaw = true;
+		wait_frozen(c);
+	}
+
+	count = signal_processes(c->dir_fd, signal);
+
+	if (thaw) {
+		error = errno;
+		write_control(c->dir_fd, "cgroup.freeze", "0");
+		errno = error;
+	}
+	return count;
+}
+
+
+char *cgroup2_mount_point()
+{
+	char *line = NULL, *mount_point = NULL, *separator;
+	char path[PATH_MAX], fstype[32];
+	size_t size = 0;
+	FILE *f = fopen("/proc/self/mountinfo", "re");
+
+	if (!f)
+		return NULL;
+	while (!mount_point && getline(&line, &size, f) > 0) {
+		// ID PARENT MAJOR:MINOR ROOT MOUNTPOINT OPTIONS [OPTIONAL...] - FSTYPE ...
+		if ((separator = strstr(line, " - ")) &&
+			sscanf(separator, " - %31s", fstype) == 1 && streq(fstype, "cgroup2") &&
+			sscanf(line, "%*s %*s %*s %*s %4095s", path) == 1)
+		{
+			mount_point = strdup(path);
+		}
+	}
+	free(line);
+	fclose(f);
+	return mount_point;
+}
+
+
+int read_events(const struct cgroup *c, bool *populated, bool *frozen)
+{
+	char buf[256], *line;
+	ssize_t n;
+	int value;
+
+	// reading from the start re-arms the notification
+	if ((n = pread(c->events_fd, buf, sizeof(buf) - 1, 0)) < 0)
+		return -1;
+	buf[n] = '\0';
+
+	*populated = *frozen = false;
+	for (line = buf; line && *line; line = strchr(line, '\n'), line = line ? line + 1 : NULL) {
+		if (sscanf(line, "populated %i", &value) == 1)
+			*populated = value != 0;
+		else if (sscanf(line, "frozen %i", &value) == 1)
+			*frozen = value != 0;
+	}
+	return 0;
+}
+
+
+int read_control(int dir_fd, const char *name, char *buf, size_t size)
+{
+	ssize_t n;
+	int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return -1;
+	n = read(fd, buf, size - 1);
+	close(fd);
+	if (n < 0)
+		return -1;
+	buf[n] = '\0';
+	return 0;
+}
+
+
+int write_control(int dir_fd, const char *name, const char *value)
+{
+	const size_t length = strlen(value);
+	ssize_t n;
+	int fd = openat(dir_fd, name, O_WRONLY | O_CLOEXEC), error;
+
+	if (fd < 0)
+		return -1;
+	n = write(fd, value, length);
+	error = errno;
+	close(fd);
+	errno = error;
+	return ((size_t) n == length) ? 0 : -1;
+}
+
+
+/*
+ * Freezing takes effect asynchronously; cgroup.events reports when it's done.
+ */
+void wait_frozen(const struct cgroup *c)
+{
+	struct pollfd pfd = { c->events_fd, POLLPRI, 0 };
+	struct timespec start, now;
+	bool populated, frozen;
+	long elapsed_ms = 0;
+
+	verify(clock_gettime(CLOCK_MONOTONIC, &start) == 0);
+	while (read_events(c, &populated, &frozen) == 0 && !frozen && populated &&
+		elapsed_ms < CGROUP_FREEZE_TIMEOUT_MS &&
+		poll(&pfd, 1, (int)(CGROUP_FREEZE_TIMEOUT_MS - elapsed_ms)) > 0)
+	{
+		verify(clock_gettime(CLOCK_MONOTONIC, &now) == 0);
+		elapsed_ms = (long)(timespec_subtract(&now, &start) * 1e3);
+	}
+}
+
+
+/*
+ * Signals the processes of the cgroup at dir_fd and of its descendants.
+ */
+long signal_processes(int dir_fd, int signal)
+{
+	long count = 0, n;
+	struct dirent *e;
+	DIR *d;
+	FILE *f;
+	int fd, pid;
+
+	if ((fd = openat(dir_fd, "cgroup.procs", O_RDONLY | O_CLOEXEC)) < 0 ||
+		!(f = fdopen(fd, "r")))
+	{
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	while (fscanf(f, "%i", &pid) == 1) {
+		if (kill(pid, signal) == 0) {
+			count++;
+		} else if (errno != ESRCH) {
+			fclose(f);
+			return -1;
+		}
+	}
+	fclose(f);
+
+	if ((fd = openat(dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0 || !(d = fdopendir(fd))) {
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	while ((e = readdir(d))) {
+		if (e->d_type != DT_DIR || e->d_name[0] == '.')
+			continue;
+		if ((fd = openat(dir_fd, e->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+			if (errno == ENOENT)
+				continue;
+			count = -1;
+			break;
+		}
+		n = signal_processes(fd, signal);
+		close(fd);
+		if (n < 0) {
+			count = -1;
+			break;
+		}
+		count += n;
+	}
+	closedir(d);
+	return count;
+}
@@ -0,0 +1,60 @@
+/*
+ * cgroup.h
+ *
+ *  Created on: 17.10.2026
+ *      Author: malte
+ */
+
+#pragma once
+#ifndef CGROUP_H_
+#define CGROUP_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+
+/*
+ * A cgroup v2 directory. events_fd stays open while we wait for the group to
+ * become empty; it signals EPOLLPRI whenever cgroup.events changes.
+ */
+struct cgroup {
+	char *path;
+	int dir_fd, events_fd;
+	bool populated;
+};
+
+
+struct a_cgroup {
+	struct cgroup *values;
+	size_t length, size;
+};
+
+
+/*
+ * Adds a cgroup. Relative paths are relative to the cgroup v2 mount point.
+ */
+bool a_cgroup_push(struct a_cgroup *a, const char *path);
+
+void a_cgroup_free(struct a_cgroup *a);
+
+/*
+ * Opens the cgroup directory and cgroup.events and reads the populated state.
+ */
+bool cgroup_open(struct cgroup *c);
+
+void cgroup_close(struct cgroup *c);
+
+/*
+ * Re-reads cgroup.events and updates c->populated. Returns -1 on error.
+ */
+int cgroup_update(struct cgroup *c);
+
+/*
+ * Sends signal to every process in the cgroup and its descendants. SIGKILL
+ * goes through cgroup.kill where available; other signals are sent while the
+ * group is frozen, so no process can escape by forking. Returns the amount of
+ * processes signalled (1 for cgroup.kill) or -1 on error.
+ */
+long cgroup_signal(struct cgroup *c, int signal);
+
+#endif /* CGROUP_H_ */
@@ -0,0 +1,645 @@
+/*
+ * daemon.c
+ *
+ *  Created on: 17.10.2026
+ *      Author: malte
+ */
+
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE
+#endif
+#include "daemon.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "utils.h"
+#include "tracker.h"
+
+
+#define DAEMON_BACKLOG 16
+
+// no sane request comes close
+#define REQUEST_MAX_LENGTH (16UL << 20)
+
+
+/*
+ * A request is a header with the length of the arguments and, as ancillary
+ * data, the client's working directory, standard output and error, followed
+ * by the NUL-terminated arguments. The response is a single byte with the
+ * exit status of the job.
+ */
+enum request_fd {
+	REQUEST_CWD,
+	REQUEST_STDOUT,
+	REQUEST_STDERR,
+	_REQUEST_FD_COUNT
+};
+
+struct request_header {
+	uint32_t length;
+};
+
+
+enum daemon_event_source {
+	DAEMON_EVENT_LISTEN,
+	DAEMON_EVENT_SIGNAL,
+	DAEMON_EVENT_CLIENT,
+	DAEMON_EVENT_TRACKER
+};
+
+static inline
+uint64_t daemon_event_data(enum daemon_event_source source, pid_t pid)
+{
+	return ((uint64_t) source << 32) | (uint32_t) pid;
+}
+
+
+struct job {
+	pid_t pid;
+	int fd;
+};
+
+static
+struct server {
+	const char *path;
+	int listen_fd, epoll_fd, signal_fd;
+	sigset_t old_mask;
+
+	struct job *jobs;
+	size_t length, size;
+	bool stopping;
+}
+server = { .listen_fd = -1, .epoll_fd = -1, .signal_fd = -1 };
+
+
+// forward declarations ===================================
+
+static bool server_init(const char *path);
+
+static void server_free(void);
+
+static bool server_add(int fd, uint32_t events, uint64_t data);
+
+static void accept_client(daemon_job job);
+
+static void run_worker(int fd, daemon_job job) __attribute__((noreturn));
+
+static char **read_request(int fd, int fds[_REQUEST_FD_COUNT], int *argc);
+
+static bool handle_signals(void);
+
+static void reap_jobs(void);
+
+static void hang_up(pid_t pid);
+
+static void stop(void);
+
+static struct job *find_job(pid_t pid);
+
+static ssize_t read_fully(int fd, void *buf, size_t size);
+
+static bool write_fully(int fd, const void *buf, size_t size);
+
+
+// implementation =========================================
+
+int daemon_main(const char *path, daemon_job job)
+{
+	struct epoll_event events[16], *e;
+	bool error_occured = false;
+	int n;
+
+	if (!server_init(path)) {
+		server_free();
+		return EXIT_FAILURE;
+	}
+
+	while (!server.stopping || server.length) {
+		n = epoll_wait(server.epoll_fd, events, (int) elementsof(events), -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			warn("epoll_wait");
+			error_occured = true;
+			break;
+		}
+
+		for (e = events; e != events + n; e++) {
+			switch ((enum daemon_event_source)(e->data.u64 >> 32)) {
+				case DAEMON_EVENT_LISTEN:
+					if (!server.stopping)
+						accept_client(job);
+					break;
+
+				case DAEMON_EVENT_SIGNAL:
+					if (!handle_signals())
+						error_occured = true;
+					break;
+
+				case DAEMON_EVENT_CLIENT:
+					hang_up((pid_t)(uint32_t) e->data.u64);
+					break;
+
+				case DAEMON_EVENT_TRACKER:
+					tracker_handle((int)(uint32_t) e->data.u64);
+					break;
+			}
+		}
+	}
+
+	server_free();
+	return error_occured ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+int daemon_request(const char *path, int argc, char *argv[])
+{
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+	union {
+		char buf[CMSG_SPACE(_REQUEST_FD_COUNT * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct request_header header = { 0 };
+	struct iovec iov = { &header, sizeof(header) };
+	struct msghdr message = {
+		.msg_iov = &iov, .msg_iovlen = 1,
+		.msg_control = control.buf, .msg_controllen = sizeof(control.buf)
+	};
+	struct cmsghdr *cmsg;
+	int fds[_REQUEST_FD_COUNT], fd, i;
+	char *arguments = NULL, *s;
+	unsigned char status;
+	size_t length = 0;
+
+	if (strlen(path) >= sizeof(address.sun_path))
+		return -1;
+	strcpy(address.sun_path, path);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+		return -1;
+	if (connect(fd, (const struct sockaddr*) &address, sizeof(address)) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	for (i = 0; i < argc; i++)
+		length += strlen(argv[i]) + 1;
+	if (length > REQUEST_MAX_LENGTH) {
+		close(fd);
+		errno = E2BIG;
+		return -1;
+	}
+	if (!(arguments = malloc(length)) ||
+		(fds[REQUEST_CWD] = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC)) < 0)
+	{
+		free(arguments);
+		close(fd);
+		return -1;
+	}
+	for (s = arguments, i = 0; i < argc; i++)
+		s = stpcpy(s, argv[i]) + 1;
+
+	header.length = (uint32_t) length;
+	fds[REQUEST_STDOUT] = STDOUT_FILENO;
+	fds[REQUEST_STDERR] = STDERR_FILENO;
+	cmsg = CMSG_FIRSTHDR(&message);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	// from here on the daemon may have started the job, so we can't fall back
+	if (sendmsg(fd, &message, MSG_NOSIGNAL) != (ssize_t) sizeof(header) ||
+		!write_fully(fd, arguments, length))
+	{
+		warn("Sending the request to %s", path);
+		status = EXIT_FAILURE;
+	} else if (read_fully(fd, &status, sizeof(status)) != sizeof(status)) {
+		warnx("%s: The daemon hung up before the job finished.", path);
+		status = EXIT_FAILURE;
+	}
+
+	close(fds[REQUEST_CWD]);
+	free(arguments);
+	close(fd);
+	return status;
+}
+
+
+bool daemon_aborted()
+{
+	sigset_t pending;
+	return sigpending(&pending) == 0 && sigismember(&pending, DAEMON_ABORT_SIGNAL) == 1;
+}
+
+
+bool server_init(const char *path)
+{
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+	struct stat st;
+	sigset_t signals;
+	mode_t mask;
+	int r;
+
+	server.path = path;
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		errno = ENAMETOOLONG;
+		warn("%s", path);
+		return false;
+	}
+	strcpy(address.sun_path, path);
+
+	// replace the socket of a previous daemon unless it's still listening
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		if ((server.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+			warn("socket");
+			return false;
+		}
+		r = connect(server.listen_fd, (const struct sockaddr*) &address, sizeof(address));
+		close(server.listen_fd);
+		if (r == 0) {
+			warnx("%s: Another daemon is listening already.", path);
+			server.listen_fd = -1;
+			return false;
+		}
+		unlink(path);
+	}
+
+	if ((server.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) < 0) {
+		warn("socket");
+		return false;
+	}
+	mask = umask(S_IXUSR | S_IRWXG | S_IRWXO);
+	r = bind(server.listen_fd, (const struct sockaddr*) &address, sizeof(address));
+	umask(mask);
+	if (r != 0 || listen(server.listen_fd, DAEMON_BACKLOG) != 0) {
+		warn("%s", path);
+		if (r == 0)
+			unlink(path);
+		close(server.listen_fd);
+		server.listen_fd = -1;
+		return false;
+	}
+
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGCHLD);
+	signal(SIGPIPE, SIG_IGN);
+
+	if ((server.epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+		sigprocmask(SIG_BLOCK, &signals, &server.old_mask) != 0 ||
+		(server.signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC)) < 0 ||
+		!server_add(server.listen_fd, EPOLLIN, daemon_event_data(DAEMON_EVENT_LISTEN, 0)) ||
+		!server_add(server.signal_fd, EPOLLIN, daemon_event_data(DAEMON_EVENT_SIGNAL, 0))
+	) {
+		warn("Setting up the event loop");
+		return false;
+	}
+
+	// without CAP_SYS_ADMIN, jobs scan /proc for the processes using a mount
+	if (!tracker_open(server.epoll_fd, daemon_event_data(DAEMON_EVENT_TRACKER, 0)) &&
+		errno != EPERM)
+	{
+		warn("Tracking the volumes");
+	}
+	return true;
+}
+
+
+void server_free()
+{
+	struct job *j;
+
+	for (j = server.jobs; j != server.jobs + server.length; j++) {
+		if (j->fd >= 0)
+			close(j->fd);
+	}
+	free(server.jobs);
+	server.jobs = NULL;
+	server.length = server.size = 0;
+	tracker_free();
+
+	if (server.listen_fd >= 0) {
+		close(server.listen_fd);
+		unlink(server.path);
+		server.listen_fd = -1;
+	}
+	if (server.signal_fd >= 0) {
+		close(server.signal_fd);
+		server.signal_fd = -1;
+		sigprocmask(SIG_SETMASK, &server.old_mask, NULL);
+	}
+	if (server.epoll_fd >= 0) {
+		close(server.epoll_fd);
+		server.epoll_fd = -1;
+	}
+}
+
+
+bool server_add(int fd, uint32_t events, uint64_t data)
+{
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = events;
+	event.data.u64 = data;
+	return epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+
+void accept_client(daemon_job job)
+{
+	struct ucred peer;
+	socklen_t peer_size = sizeof(peer);
+	struct job *j;
+	pid_t pid;
+	int fd;
+
+	while ((fd = accept4(server.listen_fd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+		if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &peer_size) != 0 ||
+			(peer.uid != 0 && peer.uid != geteuid()))
+		{
+			close(fd);
+			continue;
+		}
+
+		if (server.length >= server.size) {
+			size_t size = server.size ? server.size * 2 : 4;
+			if (!(j = realloc(server.jobs, size * sizeof(*j)))) {
+				warn("malloc");
+				close(fd);
+				continue;
+			}
+			server.jobs = j;
+			server.size = size;
+		}
+
+		// the worker inherits the index as it is now
+		tracker_update();
+		if ((pid = fork()) < 0) {
+			warn("fork");
+			close(fd);
+			continue;
+		}
+		if (pid == 0)
+			run_worker(fd, job);
+
+		// we only learn about hang-ups; the worker reads the request
+		j = &server.jobs[server.length++];
+		j->pid = pid;
+		j->fd = fd;
+		if (!server_add(fd, EPOLLRDHUP, daemon_event_data(DAEMON_EVENT_CLIENT, pid)))
+			warn("epoll_ctl");
+	}
+
+	if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED)
+		warn("accept");
+}
+
+
+void run_worker(int fd, daemon_job job)
+{
+	int fds[_REQUEST_FD_COUNT], argc, status = EXIT_FAILURE;
+	const struct job *j;
+	sigset_t mask = server.old_mask;
+	char **argv;
+
+	// an abort stays pending until the job looks for it, so it can't cut a
+	// dismount short half way
+	signal(SIGPIPE, SIG_DFL);
+	sigaddset(&mask, DAEMON_ABORT_SIGNAL);
+	sigprocmask(SIG_SETMASK, &mask, NULL);
+	close(server.listen_fd);
+	close(server.signal_fd);
+	close(server.epoll_fd);
+	tracker_close();
+	for (j = server.jobs; j != server.jobs + server.length; j++) {
+		if (j->fd >= 0)
+			close(j->fd);
+	}
+
+	if ((argv = read_request(fd, fds, &argc))) {
+		close(fd);
+		if (fchdir(fds[REQUEST_CWD]) == 0 &&
+			dup2(fds[REQUEST_STDOUT], STDOUT_FILENO) >= 0 &&
+			dup2(fds[REQUEST_STDERR], STDERR_FILENO) >= 0)
+		{
+			close(fds[REQUEST_CWD]);
+			close(fds[REQUEST_STDOUT]);
+			close(fds[REQUEST_STDERR]);
+			status = job(argc, argv);
+		} else {
+			warn("Setting up a worker");
+		}
+	} else {
+		close(fd);
+	}
+	exit(status);
+}
+
+
+/*
+ * Returns the arguments of the request on fd as a NULL-terminated array in a
+ * single allocation and the received file descriptors in fds.
+ */
+char **read_request(int fd, int fds[_REQUEST_FD_COUNT], int *argc)
+{
+	union {
+		char buf[CMSG_SPACE(_REQUEST_FD_COUNT * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct request_header header;
+	struct iovec iov = { &header, sizeof(header) };
+	struct msghdr message = {
+		.msg_iov = &iov, .msg_iovlen = 1,
+		.msg_control = control.buf, .msg_controllen = sizeof(control.buf)
+	};
+	const struct cmsghdr *cmsg;
+	char **argv, *arguments, *s;
+	size_t count = 0, i;
+
+	if (recvmsg(fd, &message, MSG_CMSG_CLOEXEC) != (ssize_t) sizeof(header) ||
+		!(cmsg = CMSG_FIRSTHDR(&message)) ||
+		cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+		cmsg->cmsg_len != CMSG_LEN(_REQUEST_FD_COUNT * sizeof(int)))
+	{
+		warnx("Received a malformed request.");
+		return NULL;
+	}
+	memcpy(fds, CMSG_DATA(cmsg), _REQUEST_FD_COUNT * sizeof(int));
+
+	if (header.length == 0 || header.length > REQUEST_MAX_LENGTH) {
+		warnx("Received a malformed request.");
+		return NULL;
+	}
+	if (!(arguments = malloc(header.length))) {
+		warn("malloc");
+		return NULL;
+	}
+	if (read_fully(fd, arguments, header.length) != (ssize_t) header.length ||
+		arguments[header.length - 1] != '\0')
+	{
+		warnx("Received a malformed request.");
+		free(arguments);
+		return NULL;
+	}
+
+	for (s = arguments; s != arguments + header.length; s++)
+		count += !*s;
+	if (count > INT_MAX - 1 || !(argv = malloc((count + 1) * sizeof(*argv)))) {
+		warn("malloc");
+		free(arguments);
+		return NULL;
+	}
+	for (s = arguments, i = 0; i < count; i++, s = strchr(s, '\0') + 1)
+		argv[i] = s;
+	argv[count] = NULL;
+
+	*argc = (int) count;
+	return argv;
+}
+
+
+/*
+ * Returns false if something went wrong.
+ */
+bool handle_signals()
+{
+	struct signalfd_siginfo info;
+	bool child = false, drained;
+	ssize_t n;
+
+	while ((n = read(server.signal_fd, &info, sizeof(info))) == sizeof(info)) {
+		switch (info.ssi_signo) {
+			case SIGCHLD:
+				child = true;
+				break;
+
+			default:
+				stop();
+				break;
+		}
+	}
+	drained = n < 0 && errno == EAGAIN;
+
+	if (child)
+		reap_jobs();
+	return drained;
+}
+
+
+/*
+ * Reports the exit status of finished workers to their clients.
+ */
+void reap_jobs()
+{
+	unsigned char result;
+	struct job *j;
+	int status;
+	pid_t pid;
+
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		if (!(j = find_job(pid)))
+			continue;
+
+		result = (unsigned char)(
+			WIFEXITED(status) ? WEXITSTATUS(status) :
+			WIFSIGNALED(status) ? 128 + WTERMSIG(status) :
+			EXIT_FAILURE);
+		if (j->fd >= 0) {
+			send(j->fd, &result, sizeof(result), MSG_NOSIGNAL | MSG_DONTWAIT);
+			close(j->fd);
+		}
+		*j = server.jobs[--server.length];
+	}
+}
+
+
+/*
+ * The client won't read the result anymore; there's no point in waiting.
+ */
+void hang_up(pid_t pid)
+{
+	struct job *j = find_job(pid);
+
+	// already reaped in the same round
+	if (!j || j->fd < 0)
+		return;
+
+	close(j->fd);
+	j->fd = -1;
+	kill(j->pid, DAEMON_ABORT_SIGNAL);
+}
+
+
+void stop()
+{
+	const struct job *j;
+
+	if (server.stopping)
+		return;
+	server.stopping = true;
+
+	close(server.listen_fd);
+	unlink(server.path);
+	server.listen_fd = -1;
+
+	for (j = server.jobs; j != server.jobs + server.length; j++)
+		kill(j->pid, DAEMON_ABORT_SIGNAL);
+}
+
+
+struct job *find_job(pid_t pid)
+{
+	struct job *j;
+	for (j = server.jobs; j != server.jobs + server.length; j++) {
+		if (j->pid == pid)
+			return j;
+	}
+	return NULL;
+}
+
+
+ssize_t read_fully(int fd, void *buf, size_t size)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < size) {
+		n = read(fd, (char*) buf + done, size - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return n < 0 ? n : (ssize_t) done;
+		done += (size_t) n;
+	}
+	return (ssize_t) done;
+}
+
+
+bool write_fully(int fd, const void *buf, size_t size)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < size) {
+		n = send(fd, (const char*) buf + done, size - done, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		done += (size_t) n;
+	}
+	return true;
+}
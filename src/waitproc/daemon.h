@@ -0,0 +1,62 @@
+/*
+ * daemon.h
+ *
+ *  Created on: 17.10.2026
+ *      Author: malte
+ */
+
+#pragma once
+#ifndef DAEMON_H_
+#define DAEMON_H_
+
+#include <stdbool.h>
+#include <signal.h>
+
+
+/*
+ * Runs the job described by the arguments of a request (like argv) and
+ * returns its exit status.
+ */
+typedef int (*daemon_job)(int argc, char *argv[]);
+
+/*
+ * Asks a job to stop waiting and let go of its processes without killing
+ * them, whatever its options say. Workers keep it blocked all their life, so
+ * it never terminates them; the job reads it when it's ready to (see
+ * daemon_aborted()).
+ */
+#define DAEMON_ABORT_SIGNAL SIGUSR1
+
+
+/*
+ * Listens on the Unix socket at path and runs every request in a worker
+ * forked from this process, so the code and data stay paged in between
+ * requests. The worker writes to the standard output and error of the client
+ * and uses its working directory. Only root and our own user may connect.
+ * With CAP_SYS_ADMIN, the daemon also tracks the processes that use the
+ * mounted volumes (see tracker.h), so their jobs only need to scan /proc
+ * once the processes they know of are gone.
+ *
+ * SIGINT and SIGTERM stop accepting requests and abort the running jobs with
+ * DAEMON_ABORT_SIGNAL; we return once they finished. A job is aborted as well
+ * when its client hangs up.
+ *
+ * Returns an exit status.
+ */
+int daemon_main(const char *path, daemon_job job);
+
+/*
+ * Sends argv as a request to the daemon listening at path and waits for the
+ * job to finish. Returns its exit status or -1 if there is no daemon to talk
+ * to, so the caller can run the job itself.
+ */
+int daemon_request(const char *path, int argc, char *argv[]);
+
+/*
+ * Whether a worker was asked to abort (DAEMON_ABORT_SIGNAL) since its job
+ * last looked with a signalfd. Only workers block it, so elsewhere it never
+ * is.
+ */
+bool daemon_aborted(void);
+
+#endif /* DAEMON_H_ */
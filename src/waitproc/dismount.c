@@ -0,0 +1,355 @@
+/*
+ * dismount.c
+ *
+ *  Created on: 17.10.2026
+ *      Author: malte
+ */
+
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE
+#endif
+#include "dismount.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mount.h>
+#include <sys/wait.h>
+#include "utils.h"
+#include "daemon.h"
+#include "pidfd.h"
+#include "volumes.h"
+
+
+// how long to retry while busy: udev may still be looking at a device that was
+// just unmounted, killed processes may still be on their way out
+#ifndef DISMOUNT_BUSY_MS
+#	define DISMOUNT_BUSY_MS 1000
+#endif
+
+// how often to retry unmounting
+#define DISMOUNT_RETRY_MS 20
+
+
+enum dismount_state {
+	DISMOUNT_SKIPPED,
+	DISMOUNT_UNMOUNTED,
+	DISMOUNT_BUSY,
+	DISMOUNT_STUCK,
+	DISMOUNT_FAILED,
+	DISMOUNT_DONE,
+	DISMOUNT_DONE_FORCEFULLY
+};
+
+
+// forward declarations ===================================
+
+static enum dismount_state unmount_volume(const struct volume *v);
+
+static enum dismount_state unmount_busy_volume(const struct volume *v, const struct timespec *retry_until);
+
+static size_t remove_volumes(const struct a_volume *volumes, enum dismount_state *states,
+	size_t jobs, const struct timespec *deadline);
+
+static bool needs_removal(enum dismount_state state);
+
+static enum dismount_state remove_volume(const struct volume *v, enum dismount_state state,
+	const struct timespec *deadline);
+
+static bool report(const struct volume *v, enum dismount_state state);
+
+static int run_truecrypt(const struct volume *v, const struct timespec *deadline);
+
+static bool matches_any(const struct volume *v, char *const *specs, size_t spec_count);
+
+static void print_left(void);
+
+
+// implementation =========================================
+
+int dismount_volumes(char *const *specs, size_t spec_count, dismount_wait wait,
+	size_t jobs, const struct timespec *deadline)
+{
+	struct a_volume volumes;
+	const struct volume *v;
+	enum dismount_state *states;
+	char **busy;
+	struct timespec retry_until;
+	unsigned int busy_count = 0;
+	size_t i, found = 0, failed = 0;
+	bool stuck = false, aborted = false;
+	int r;
+
+	if (volumes_list(&volumes) < 0) {
+		warn("Listing the volumes");
+		return EXIT_FAILURE;
+	}
+	if (!(states = calloc(max(volumes.length, 1U), sizeof(*states))) ||
+		!(busy = malloc(max(volumes.length, 1U) * sizeof(*busy))))
+	{
+		warn("malloc");
+		free(states);
+		volumes_free(&volumes);
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < volumes.length; i++) {
+		v = &volumes.values[i];
+		if (spec_count && !matches_any(v, specs, spec_count))
+			continue;
+		found++;
+		if ((states[i] = unmount_volume(v)) == DISMOUNT_BUSY)
+			busy[busy_count++] = v->mount_point;
+	}
+
+	// one wait for all blockers instead of one per volume
+	if (busy_count) {
+		r = wait(busy, busy_count);
+		stuck = r == DISMOUNT_WAIT_STUCK;
+		aborted = r == DISMOUNT_WAIT_ABORTED || daemon_aborted();
+		VOID(clock_gettime(CLOCK_MONOTONIC, &retry_until));
+		timespec_add_ms(&retry_until, min(timespec_remaining_ms(deadline), DISMOUNT_BUSY_MS));
+		for (i = 0; i < volumes.length; i++) {
+			v = &volumes.values[i];
+			if (states[i] == DISMOUNT_BUSY)
+				states[i] = unmount_busy_volume(v, (stuck || aborted) ? NULL : &retry_until);
+			// waiting for them to let go is pointless
+			if (stuck && states[i] == DISMOUNT_FAILED)
+				states[i] = DISMOUNT_STUCK;
+		}
+	}
+
+	failed = remove_volumes(&volumes, states, jobs, deadline);
+
+	free(busy);
+	free(states);
+	volumes_free(&volumes);
+
+	if (spec_count && !found) {
+		warnx("No such volume is mounted.");
+		return EXIT_FAILURE;
+	}
+	if (failed) {
+		print_left();
+		return EXIT_FAILURE;
+	}
+	return (fflush(stdout) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+enum dismount_state unmount_volume(const struct volume *v)
+{
+	if (!v->mount_point || umount2(v->mount_point, 0) == 0)
+		return DISMOUNT_UNMOUNTED;
+	if (errno == EBUSY)
+		return DISMOUNT_BUSY;
+	warn("%s", v->mount_point);
+	return DISMOUNT_FAILED;
+}
+
+
+/*
+ * Unmounts a volume after waiting for its users. The killed ones may still be
+ * on their way out, so we keep trying until retry_until, or just once without
+ * or once the job is aborted.
+ */
+enum dismount_state unmount_busy_volume(const struct volume *v, const struct timespec *retry_until)
+{
+	const struct timespec delay = { 0, DISMOUNT_RETRY_MS * 1000000L };
+
+	while (umount2(v->mount_point, 0) != 0) {
+		if (errno != EBUSY || !retry_until || timespec_remaining_ms(retry_until) <= 0 || daemon_aborted()) {
+			warn("%s", v->mount_point);
+			return DISMOUNT_FAILED;
+		}
+		nanosleep(&delay, NULL);
+	}
+	return DISMOUNT_DONE_FORCEFULLY;
+}
+
+
+/*
+ * Removes the mappings of the unmounted volumes in a worker per volume, up to
+ * jobs at once (0 for all), so a slow one doesn't hold up the others. Every
+ * volume is reported as soon as it's done. Returns how many failed.
+ */
+size_t remove_volumes(const struct a_volume *volumes, enum dismount_state *states,
+	size_t jobs, const struct timespec *deadline)
+{
+	const struct volume *v;
+	pid_t *workers, pid;
+	size_t i, next = 0, running = 0, failed = 0;
+	int status;
+
+	// without workers, one after another
+	if (!(workers = calloc(max(volumes->length, 1U), sizeof(*workers)))) {
+		warn("malloc");
+		jobs = 1;
+	}
+
+	while (next < volumes->length || running) {
+		while (next < volumes->length && (!jobs || running < jobs)) {
+			i = next++;
+			v = &volumes->values[i];
+			if (states[i] == DISMOUNT_SKIPPED)
+				continue;
+			if (!needs_removal(states[i])) {
+				failed += report(v, states[i]);
+				continue;
+			}
+			if (workers && (workers[i] = fork()) == 0)
+				_exit(remove_volume(v, states[i], deadline));
+			if (!workers || workers[i] < 0) {
+				if (workers)
+					warn("fork");
+				states[i] = remove_volume(v, states[i], deadline);
+				failed += report(v, states[i]);
+			} else {
+				running++;
+			}
+		}
+
+		if (!running)
+			continue;
+		if ((pid = waitpid(-1, &status, 0)) < 0) {
+			if (errno == EINTR)
+				continue;
+			warn("waitpid");
+			break;
+		}
+		for (i = 0; i < volumes->length && workers[i] != pid; i++)
+			;
+		if (i == volumes->length)
+			continue;
+		workers[i] = 0;
+		running--;
+		states[i] = WIFEXITED(status) ? (enum dismount_state) WEXITSTATUS(status) : DISMOUNT_FAILED;
+		failed += report(&volumes->values[i], states[i]);
+	}
+
+	free(workers);
+	return failed;
+}
+
+
+bool needs_removal(enum dismount_state state)
+{
+	return state == DISMOUNT_UNMOUNTED || state == DISMOUNT_DONE_FORCEFULLY || state == DISMOUNT_STUCK;
+}
+
+
+/*
+ * Removes the mapping of an unmounted volume and returns the final state.
+ * TrueCrypt gets to force it where we can't, if there's time left, and
+ * dismounts the volumes whose users are stuck.
+ */
+enum dismount_state remove_volume(const struct volume *v, enum dismount_state state,
+	const struct timespec *deadline)
+{
+	if (!needs_removal(state))
+		return state;
+	if (state != DISMOUNT_STUCK) {
+		if (volume_remove(v, min(timespec_remaining_ms(deadline), DISMOUNT_BUSY_MS)) == 0)
+			return (state == DISMOUNT_UNMOUNTED) ? DISMOUNT_DONE : state;
+		if (errno != ENOTSUP)
+			warn("Removing %s", v->mapper);
+	}
+
+	if (timespec_remaining_ms(deadline) <= 0) {
+		warnx("No time left to run %s.", v->flavour);
+		return DISMOUNT_FAILED;
+	}
+	return (run_truecrypt(v, deadline) == 0) ? DISMOUNT_DONE_FORCEFULLY : DISMOUNT_FAILED;
+}
+
+
+/*
+ * Prints the outcome for v and returns whether it failed. It goes out right
+ * away, and workers forked later don't inherit it.
+ */
+bool report(const struct volume *v, enum dismount_state state)
+{
+	if (state == DISMOUNT_FAILED) {
+		fprintf(stderr, "Slot %u (%s): failed\n", v->slot, v->device ? v->device : "-");
+		return true;
+	}
+	printf("Slot %u (%s): dismounted%s\n", v->slot, v->device ? v->device : "-",
+		(state == DISMOUNT_DONE_FORCEFULLY) ? " forcefully" : "");
+	fflush(stdout);
+	return false;
+}
+
+
+int run_truecrypt(const struct volume *v, const struct timespec *deadline)
+{
+	const long remaining_ms = timespec_remaining_ms(deadline);
+	struct pollfd pfd;
+	char slot[32];
+	int status;
+	pid_t pid;
+
+	snprintf(slot, sizeof(slot), "--slot=%u", v->slot);
+	fflush(stdout);
+	if ((pid = fork()) < 0) {
+		warn("fork");
+		return -1;
+	}
+	if (pid == 0) {
+		execlp(v->flavour, v->flavour, "-t", "-d", "--force", slot, (char*) NULL);
+		warn("%s", v->flavour);
+		_exit(127);
+	}
+
+	// kill it at the deadline; without pidfds it has to finish on its own
+	if (remaining_ms != LONG_MAX && (pfd.fd = sys_pidfd_open(pid, 0)) >= 0) {
+		pfd.events = POLLIN;
+		while ((status = poll(&pfd, 1, (int) min(remaining_ms, INT_MAX))) < 0 && errno == EINTR)
+			;
+		if (status == 0) {
+			warnx("%s ran out of time.", v->flavour);
+			kill(pid, SIGKILL);
+		}
+		close(pfd.fd);
+	}
+
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR)
+			return -1;
+	}
+	return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : -1;
+}
+
+
+bool matches_any(const struct volume *v, char *const *specs, size_t spec_count)
+{
+	size_t i;
+	for (i = 0; i < spec_count; i++) {
+		if (volume_matches(v, specs[i]))
+			return true;
+	}
+	return false;
+}
+
+
+void print_left()
+{
+	struct a_volume volumes;
+	const struct volume *v;
+
+	fputs("Something blocked (forcefully) unmounting one or more TrueCrypt "
+		"partitions even after killing all processes using them. Those are left:\n",
+		stderr);
+	if (volumes_list(&volumes) < 0) {
+		warn("Listing the volumes");
+		return;
+	}
+	for (v = volumes.values; v != volumes.values + volumes.length; v++) {
+		fprintf(stderr, "%u: %s %s %s\n", v->slot,
+			v->device ? v->device : "-", v->mapper ? v->mapper : "-",
+			v->mount_point ? v->mount_point : "-");
+	}
+	volumes_free(&volumes);
+}
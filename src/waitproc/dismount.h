@@ -0,0 +1,46 @@
+/*
+ * dismount.h
+ *
+ *  Created on: 17.10.2026
+ *      Author: malte
+ */
+
+#pragma once
+#ifndef DISMOUNT_H_
+#define DISMOUNT_H_
+
+#include <stddef.h>
+#include <time.h>
+
+
+/*
+ * Waits for the processes that use the mount points to go away and returns
+ * an exit status, DISMOUNT_WAIT_STUCK if it gave up on processes stuck in
+ * uninterruptible sleep, or DISMOUNT_WAIT_ABORTED if it was asked to stop.
+ */
+typedef int (*dismount_wait)(char **mount_points, unsigned int count);
+
+#define DISMOUNT_WAIT_STUCK 3
+#define DISMOUNT_WAIT_ABORTED -1
+
+
+/*
+ * Dismounts the volumes that match one of the specs (see volume_matches()) or
+ * all of them without any. Every volume is unmounted right away if possible;
+ * the mount points that are busy go to wait together, and are unmounted once
+ * it returns, retrying for up to a second while the killed processes go away.
+ * Then the mappings of the unmounted volumes are removed, up to jobs at once (0
+ * for all of them).
+ *
+ * With a deadline (CLOCK_MONOTONIC, zero for none), the retries end then at
+ * the latest, and the removal of the mappings and VeraCrypt get what is left
+ * of it; the wait needs to keep some for them. After an aborted wait, the busy
+ * volumes get a single try and are never forced.
+ *
+ * Reports the outcome for every volume on stdout and the volumes that are
+ * left on stderr. Returns an exit status.
+ */
+int dismount_volumes(char *const *specs, size_t spec_count, dismount_wait wait,
+	size_t jobs, const struct timespec *deadline);
+
+#endif /* DISMOUNT_H_ */
@@ -20,10 +20,23 @@
 #	define FLAGGED_BUFFER_INITIALLENGTH 4U
 #endif
 
+#define INDEX_EMPTY SIZE_MAX
+
+
+// forward declarations ===================================
+
+static size_t *index_slot(const struct a_flagged_int *a, long val);
+
+static bool index_resize(struct a_flagged_int *a, size_t length);
+
+static void swap_elements(struct a_flagged_int *a, size_t i, size_t j);
+
+
+// implementation =========================================
 
 bool a_flagged_int_init(struct a_flagged_int *a, size_t size)
 {
-	assert(!a->values);
+	assert(!a->values && !a->index);
 
 	if (!size)
 		size = FLAGGED_BUFFER_INITIALLENGTH;
@@ -34,6 +47,14 @@ bool a_flagged_int_init(struct a_flagged_int *a, size_t size)
 #endif
 	a->size = a->values ? size : 0;
 	a->length = 0;
+	a->live = 0;
+	a->index_size = 0;
+
+	if (a->values && !index_resize(a, size)) {
+		free(a->values);
+		a->values = NULL;
+		a->size = 0;
+	}
 
 	return !!a->values;
 }
@@ -42,8 +63,9 @@ bool a_flagged_int_init(struct a_flagged_int *a, size_t size)
 void a_flagged_int_free(struct a_flagged_int *a)
 {
 	if (a->values) {
-		assert(a->length <= a->size);
+		assert(a->length <= a->size && a->live <= a->length);
 		free(a->values);
+		free(a->index);
 #ifndef NDEBUG
 		memset(a, 0x55, sizeof(*a));
 #endif
@@ -53,22 +75,28 @@ void a_flagged_int_free(struct a_flagged_int *a)
 
 struct flagged_int *get_flagged_int(struct a_flagged_int *a, long val)
 {
-	struct flagged_int *p = a->values;
-	const struct flagged_int *const p_end = a_flagged_int_end(a);
-	for (; p != p_end; p++) {
-		if (p->i == val)
-			return p;
-	}
-	return NULL;
+	const size_t *slot;
+	if (!a->index_size)
+		return NULL;
+	slot = index_slot(a, val);
+	return (*slot != INDEX_EMPTY) ? &a->values[*slot] : NULL;
 }
 
 
 void a_flagged_each(struct a_flagged_int *a, a_flagged_callback callback, void *data)
 {
-	struct flagged_int *p = a->values;
-	const struct flagged_int *const p_end = p + a->length;
-	while (p != p_end && p->valid && callback(p, data))
-		p++;
+	size_t i = 0;
+	while (i < a->live) {
+		// the callback may push new elements and thus move the array
+		bool proceed = !a->values[i].valid || callback(&a->values[i], data);
+		if (!a->values[i].valid) {
+			a_flagged_int_retire(a, &a->values[i]);
+		} else {
+			i++;
+		}
+		if (!proceed)
+			break;
+	}
 }
 
 
@@ -76,12 +104,15 @@ bool push_flagged_int(struct a_flagged_int *a, long value, bool valid)
 {
 	struct flagged_int *elem;
 
+	if (a->index_size && *index_slot(a, value) != INDEX_EMPTY)
+		return true;
+
 	if (a->length >= a->size) {
 		assert(a->length == a->size);
 		if (!a->values) {
 			assert(a->size == 0);
 			a->size = FLAGGED_BUFFER_INITIALLENGTH;
-		} if (a->size > SIZE_MAX / 2) {
+		} else if (a->size > SIZE_MAX / 2) {
 			if (a->size == SIZE_MAX) {
 				assert(a->size != SIZE_MAX);
 				errno = ERANGE;
@@ -99,25 +130,59 @@ bool push_flagged_int(struct a_flagged_int *a, long value, bool valid)
 		a->values = elem;
 	}
 
-	elem = &a->values[a->length++];
+	if (a->index_size < 2 * (a->length + 1) && !index_resize(a, a->length + 1))
+		return false;
+
+	elem = &a->values[a->length];
+	memset(elem, 0, sizeof(*elem));
 	elem->i = value;
 	elem->state = STATE_INITIAL;
+	elem->fd = -1;
 	elem->valid = valid;
+	elem->status = -1;
+	*index_slot(a, value) = a->length++;
+
+	if (valid)
+		swap_elements(a, a->live++, a->length - 1);
 
 	return true;
 }
 
 
+void a_flagged_int_retire(struct a_flagged_int *a, struct flagged_int *p)
+{
+	size_t i = (size_t)(p - a->values);
+	assert(i < a->length);
+
+	p->valid = false;
+	if (i < a->live)
+		swap_elements(a, i, --a->live);
+}
+
+
 void a_flagged_int_slice(struct a_flagged_int *a, ssize_t start_, size_t count)
 {
-	size_t start = (size_t) ((start_ >= 0) ? 
-		start_ : 
+	size_t start = (size_t) ((start_ >= 0) ?
+		start_ :
 		(start_ + (ssize_t) a->length));
 	if (start < a->length) {
+		size_t i;
 		if (start + count > a->length)
 			count = a->length - start;
-		memmove(&a->values[start], &a->values[start + count], (a->length - start - count) * sizeof(a->values));
+		memmove(&a->values[start], &a->values[start + count], (a->length - start - count) * sizeof(*a->values));
 		a->length -= count;
+
+		// restore the partition and the index
+		a->live = 0;
+		for (i = 0; i < a->length; i++) {
+			if (a->values[i].valid) {
+				struct flagged_int tmp = a->values[i];
+				a->values[i] = a->values[a->live];
+				a->values[a->live++] = tmp;
+			}
+		}
+		// the index doesn't need to grow, so this cannot fail
+		(void) index_resize(a, a->length);
 	}
 }
 
@@ -133,6 +198,68 @@ ssize_t a_flagged_int_remove(struct a_flagged_int *a, struct flagged_int *p)
 }
 
 
+size_t *index_slot(const struct a_flagged_int *a, long val)
+{
+	// Fibonacci hashing; index_size is a power of 2
+	const size_t mask = a->index_size - 1;
+	size_t h = (size_t)((uint64_t)(unsigned long) val * UINT64_C(0x9E3779B97F4A7C15) >> 32) & mask;
+
+	assert(a->index_size && !(a->index_size & mask));
+
+	while (a->index[h] != INDEX_EMPTY && a->values[a->index[h]].i != val)
+		h = (h + 1) & mask;
+	return &a->index[h];
+}
+
+
+/*
+ * Rebuilds the index with a capacity for at least length elements at a load
+ * factor of no more than 1/2.
+ */
+bool index_resize(struct a_flagged_int *a, size_t length)
+{
+	size_t index_size = a->index_size ? a->index_size : 8, i;
+	size_t *index;
+
+	while (index_size < 2 * length) {
+		if (index_size > SIZE_MAX / 2 / sizeof(*index)) {
+			errno = ERANGE;
+			return false;
+		}
+		index_size *= 2;
+	}
+
+	if (index_size != a->index_size) {
+		if (!(index = malloc(index_size * sizeof(*index))))
+			return false;
+		free(a->index);
+		a->index = index;
+		a->index_size = index_size;
+	}
+
+	memset(a->index, 0xff, a->index_size * sizeof(*a->index));
+	for (i = 0; i < a->length; i++)
+		*index_slot(a, a->values[i].i) = i;
+
+	return true;
+}
+
+
+void swap_elements(struct a_flagged_int *a, size_t i, size_t j)
+{
+	if (i != j) {
+		// look up the slots before the elements move
+		size_t *slot_i = index_slot(a, a->values[i].i),
+			*slot_j = index_slot(a, a->values[j].i);
+		struct flagged_int tmp = a->values[i];
+		a->values[i] = a->values[j];
+		a->values[j] = tmp;
+		*slot_i = j;
+		*slot_j = i;
+	}
+}
+
+
 #ifndef NDBEUG
 INLINE struct flagged_int *a_flagged_int_end(struct a_flagged_int *a);
 #endif
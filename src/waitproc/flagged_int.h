@@ -12,6 +12,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <unistd.h>
+#include <time.h>
 #include <assert.h>
 
 
@@ -35,13 +36,41 @@ struct flagged_int {
 		STATE_DETACHED,
 		STATE_TERMINATED
 	} state;
+	int fd;
 	bool valid;
+
+	// what happened when
+	struct timespec attached, signalled, exited;
+	int signal, status;
+
+	// whether it had files open for writing when we found it (--writers-first)
+	bool writer;
+
+	// since when one of its threads has been in uninterruptible sleep, which
+	// one, and whether we reported it
+	struct timespec uninterruptible;
+	pid_t blocked_tid;
+	bool stuck;
+	enum flagged_cause {
+		CAUSE_NONE = 0,
+		CAUSE_EXITED,
+		CAUSE_KILLED,
+		CAUSE_VANISHED
+	} cause;
 };
 
 
+/*
+ * The valid elements are kept at the front of values, i. e. in
+ * [0, live); a_flagged_each() moves elements that became invalid behind
+ * them. index is an open-addressing hash table over all elements that maps
+ * their value to their position in values.
+ */
 struct a_flagged_int {
 	struct flagged_int *values;
-	size_t length, size;
+	size_t length, size, live;
+	size_t *index;
+	size_t index_size;
 };
 
 
@@ -58,6 +87,8 @@ void a_flagged_each(struct a_flagged_int *a, a_flagged_callback callback, void *
 
 bool push_flagged_int(struct a_flagged_int *a, long value, bool valid);
 
+void a_flagged_int_retire(struct a_flagged_int *a, struct flagged_int *p);
+
 void a_flagged_int_slice(struct a_flagged_int *a, ssize_t start_, size_t count);
 
 ssize_t a_flagged_int_remove(struct a_flagged_int *a, struct flagged_int *p);
@@ -0,0 +1,47 @@
+/*
+ * pidfd.h
+ *
+ *  Created on: 17.10.2026
+ *      Author: malte
+ */
+
+#pragma once
+#ifndef PIDFD_H_
+#define PIDFD_H_
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+
+// Older C libraries have no wrappers (and older kernel headers no syscall
+// numbers) for these; the numbers are the same on all architectures.
+#ifndef __NR_pidfd_send_signal
+#	define __NR_pidfd_send_signal 424
+#endif
+#ifndef __NR_pidfd_open
+#	define __NR_pidfd_open 434
+#endif
+
+
+static inline
+int sys_pidfd_open(pid_t pid, unsigned int flags);
+
+static inline
+int sys_pidfd_send_signal(int pidfd, int sig, siginfo_t *info, unsigned int flags);
+
+
+// implementations ========================================
+
+int sys_pidfd_open(pid_t pid, unsigned int flags)
+{
+	return (int) syscall(__NR_pidfd_open, pid, flags);
+}
+
+
+int sys_pidfd_send_signal(int pidfd, int sig, siginfo_t *info, unsigned int flags)
+{
+	return (int) syscall(__NR_pidfd_send_signal, pidfd, sig, info, flags);
+}
+
+#endif /* PIDFD_H_ */
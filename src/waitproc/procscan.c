@@ -0,0 +1,447 @@
+/*
+ * procscan.c
+ *
+ *  Created on: 17.10.2026
+ *      Author: malte
+ */
+
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE
+#endif
+#include "procscan.h"
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include "utils.h"
+
+
+#ifndef PROCSCAN_CHUNK
+#	define PROCSCAN_CHUNK 32U
+#endif
+
+
+struct procscan_job {
+	const dev_t *devices;
+	size_t device_count;
+	int proc_fd;
+	pid_t self;
+
+	const pid_t *pids;
+	size_t pid_count;
+	size_t next;
+};
+
+
+struct procscan_worker {
+	struct procscan_job *job;
+	pthread_t thread;
+	pid_t *found;
+	size_t found_count, found_size;
+	bool failed;
+};
+
+
+// forward declarations ===================================
+
+static bool device_matches(const struct procscan_job *job, dev_t dev);
+
+static bool process_uses_devices(const struct procscan_job *job, pid_t pid);
+
+static void *procscan_worker_run(void *worker_);
+
+static pid_t *list_processes(size_t *count);
+
+static bool is_writable(int fdinfo_fd, const char *fd);
+
+static bool read_state(const char *dir, struct procscan_state *state);
+
+
+// implementation =========================================
+
+int mount_device(const char *path, dev_t *dev)
+{
+	struct stat st, parent;
+	int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC), r;
+	if (fd < 0)
+		return -1;
+
+	r = fstat(fd, &st) == 0 && fstatat(fd, "..", &parent, 0) == 0;
+	close(fd);
+	if (!r)
+		return -1;
+
+	if (st.st_dev == parent.st_dev && st.st_ino != parent.st_ino) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	*dev = st.st_dev;
+	return 0;
+}
+
+
+ssize_t procscan(const dev_t *devices, size_t device_count,
+	struct a_flagged_int *pids, unsigned int thread_count)
+{
+	pid_t *processes;
+	size_t count;
+	ssize_t found;
+
+	if (!(processes = list_processes(&count)))
+		return -1;
+
+	found = procscan_among(devices, device_count, processes, count, pids, thread_count);
+	free(processes);
+	return found;
+}
+
+
+ssize_t procscan_among(const dev_t *devices, size_t device_count,
+	const pid_t *candidates, size_t candidate_count,
+	struct a_flagged_int *pids, unsigned int thread_count)
+{
+	struct procscan_job job;
+	struct procscan_worker *workers;
+	size_t i, j;
+	ssize_t found = 0;
+
+	if ((job.proc_fd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+		return -1;
+	job.devices = devices;
+	job.device_count = device_count;
+	job.self = getpid();
+	job.pids = candidates;
+	job.pid_count = candidate_count;
+	job.next = 0;
+
+	if (!thread_count) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		thread_count = (cpus > 0) ? (unsigned int) min(cpus, UINT_MAX) : 1;
+	}
+	thread_count = (unsigned int) min(thread_count,
+		(job.pid_count + PROCSCAN_CHUNK - 1) / PROCSCAN_CHUNK);
+	if (!thread_count)
+		thread_count = 1;
+
+	if (!(workers = calloc(thread_count, sizeof(*workers)))) {
+		close(job.proc_fd);
+		return -1;
+	}
+
+	// the calling thread is the first worker
+	for (i = 0; i < thread_count; i++) {
+		workers[i].job = &job;
+		if (i && pthread_create(&workers[i].thread, NULL, &procscan_worker_run, &workers[i]) != 0) {
+			thread_count = (unsigned int) i;
+			break;
+		}
+	}
+	procscan_worker_run(&workers[0]);
+
+	for (i = 0; i < thread_count; i++) {
+		if (i)
+			verify(pthread_join(workers[i].thread, NULL) == 0);
+		if (workers[i].failed)
+			found = -1;
+		for (j = 0; found >= 0 && j < workers[i].found_count; j++) {
+			if (push_flagged_int(pids, workers[i].found[j], true)) {
+				found++;
+			} else {
+				found = -1;
+			}
+		}
+		free(workers[i].found);
+	}
+
+	free(workers);
+	close(job.proc_fd);
+	return found;
+}
+
+
+ssize_t procscan_writable(pid_t pid, const dev_t *devices, size_t device_count)
+{
+	const struct procscan_job job = { .devices = devices, .device_count = device_count };
+	const struct dirent *entry;
+	struct stat st;
+	char path[32];
+	int fd, fdinfo_fd;
+	ssize_t count = 0;
+	DIR *dir;
+
+	snprintf(path, sizeof(path), "/proc/%d/fdinfo", pid);
+	if ((fdinfo_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+		return -1;
+	snprintf(path, sizeof(path), "/proc/%d/fd", pid);
+	if ((fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0 || !(dir = fdopendir(fd))) {
+		if (fd >= 0)
+			close(fd);
+		close(fdinfo_fd);
+		return -1;
+	}
+
+	// pipes, sockets and terminals have nothing to write back
+	while ((entry = readdir(dir))) {
+		if (entry->d_name[0] == '.' || fstatat(fd, entry->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode))
+			continue;
+		if (device_count && !device_matches(&job, st.st_dev))
+			continue;
+		if (is_writable(fdinfo_fd, entry->d_name))
+			count++;
+	}
+	closedir(dir);
+	close(fdinfo_fd);
+	return count;
+}
+
+
+bool procscan_state(pid_t pid, struct procscan_state *state)
+{
+	char dir[32];
+
+	snprintf(dir, sizeof(dir), "/proc/%d", pid);
+	return read_state(dir, state);
+}
+
+
+bool procscan_blocked(pid_t pid, pid_t tid, struct procscan_state *state)
+{
+	struct procscan_state thread;
+	const struct dirent *entry;
+	char dir[48];
+	pid_t t;
+	DIR *tasks;
+
+	// the one that was blocked before, so we see how long it stays that way
+	if (tid > 0) {
+		snprintf(dir, sizeof(dir), "/proc/%d/task/%d", pid, tid);
+		if (read_state(dir, state) && state->state == 'D') {
+			state->tid = tid;
+			return true;
+		}
+	}
+
+	if (!procscan_state(pid, state))
+		return false;
+	state->tid = pid;
+	if (state->state == 'D')
+		return true;
+
+	snprintf(dir, sizeof(dir), "/proc/%d/task", pid);
+	if (!(tasks = opendir(dir)))
+		return true;
+	while ((entry = readdir(tasks))) {
+		if ((t = (pid_t) strtol(entry->d_name, NULL, 10)) <= 0 || t == pid || t == tid)
+			continue;
+		snprintf(dir, sizeof(dir), "/proc/%d/task/%d", pid, t);
+		if (read_state(dir, &thread) && thread.state == 'D') {
+			*state = thread;
+			state->tid = t;
+			break;
+		}
+	}
+	closedir(tasks);
+	return true;
+}
+
+
+bool read_state(const char *dir, struct procscan_state *state)
+{
+	char path[64], buf[512], *s;
+	ssize_t n;
+	int fd;
+
+	memset(state, 0, sizeof(*state));
+	snprintf(path, sizeof(path), "%s/stat", dir);
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return false;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return false;
+	buf[n] = '\0';
+
+	// PID (COMM) STATE ...; COMM may contain anything
+	if (!(s = strrchr(buf, ')')) || !s[1] || !(state->state = s[2]))
+		return false;
+
+	snprintf(path, sizeof(path), "%s/wchan", dir);
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) >= 0) {
+		n = read(fd, state->wchan, sizeof(state->wchan) - 1);
+		close(fd);
+		state->wchan[max(n, 0)] = '\0';
+		// "0" when it's running
+		if (streq1(state->wchan, '0'))
+			*state->wchan = '\0';
+	}
+	return true;
+}
+
+
+bool device_matches(const struct procscan_job *job, dev_t dev)
+{
+	const dev_t *d = job->devices, *const d_end = d + job->device_count;
+	for (; d != d_end; d++) {
+		if (*d == dev)
+			return true;
+	}
+	return false;
+}
+
+
+bool process_uses_devices(const struct procscan_job *job, pid_t pid)
+{
+	static const char *const links[] = { "cwd", "root", "exe" };
+
+	char path[32];
+	struct stat st;
+	const char *const *link;
+	int fd;
+
+	for (link = links; link != array_end(links); link++) {
+		snprintf(path, sizeof(path), "%d/%s", pid, *link);
+		if (fstatat(job->proc_fd, path, &st, 0) == 0 && device_matches(job, st.st_dev))
+			return true;
+	}
+
+	snprintf(path, sizeof(path), "%d/fd", pid);
+	if ((fd = openat(job->proc_fd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) >= 0) {
+		DIR *dir = fdopendir(fd);
+		if (dir) {
+			const struct dirent *entry;
+			bool match = false;
+			while (!match && (entry = readdir(dir))) {
+				match = entry->d_name[0] != '.' &&
+					fstatat(fd, entry->d_name, &st, 0) == 0 &&
+					device_matches(job, st.st_dev);
+			}
+			closedir(dir);
+			if (match)
+				return true;
+		} else {
+			close(fd);
+		}
+	}
+
+	snprintf(path, sizeof(path), "%d/maps", pid);
+	if ((fd = openat(job->proc_fd, path, O_RDONLY | O_CLOEXEC)) >= 0) {
+		FILE *maps = fdopen(fd, "r");
+		if (maps) {
+			char line[512];
+			unsigned int dev_major, dev_minor;
+			unsigned long inode;
+			bool match = false;
+			while (!match && fgets(line, sizeof(line), maps)) {
+				match = sscanf(line, "%*s %*s %*s %x:%x %lu", &dev_major, &dev_minor, &inode) == 3 &&
+					inode != 0 &&
+					device_matches(job, makedev(dev_major, dev_minor));
+
+				// skip the rest of overlong lines
+				while (!strchr(line, '\n') && fgets(line, sizeof(line), maps))
+					;
+			}
+			fclose(maps);
+			if (match)
+				return true;
+		} else {
+			close(fd);
+		}
+	}
+
+	return false;
+}
+
+
+void *procscan_worker_run(void *worker_)
+{
+	struct procscan_worker *worker = (struct procscan_worker*) worker_;
+	struct procscan_job *job = worker->job;
+	size_t i, end;
+
+	while ((i = __atomic_fetch_add(&job->next, PROCSCAN_CHUNK, __ATOMIC_RELAXED)) < job->pid_count) {
+		end = min(i + PROCSCAN_CHUNK, job->pid_count);
+		for (; i < end; i++) {
+			if (job->pids[i] == job->self || !process_uses_devices(job, job->pids[i]))
+				continue;
+
+			if (worker->found_count >= worker->found_size) {
+				size_t size = worker->found_size ? worker->found_size * 2 : 16;
+				pid_t *found = realloc(worker->found, size * sizeof(*found));
+				if (!found) {
+					worker->failed = true;
+					return NULL;
+				}
+				worker->found = found;
+				worker->found_size = size;
+			}
+			worker->found[worker->found_count++] = job->pids[i];
+		}
+	}
+
+	return NULL;
+}
+
+
+pid_t *list_processes(size_t *count)
+{
+	DIR *dir = opendir("/proc");
+	const struct dirent *entry;
+	pid_t *pids = NULL, *p;
+	size_t size = 0;
+	char *end;
+	long pid;
+
+	if (!dir)
+		return NULL;
+
+	*count = 0;
+	while ((entry = readdir(dir))) {
+		pid = strtol(entry->d_name, &end, 10);
+		if (*end || pid <= 0 || pid > INT_MAX)
+			continue;
+
+		if (*count >= size) {
+			size = size ? size * 2 : 256;
+			if (!(p = realloc(pids, size * sizeof(*pids)))) {
+				free(pids);
+				closedir(dir);
+				return NULL;
+			}
+			pids = p;
+		}
+		pids[(*count)++] = (pid_t) pid;
+	}
+
+	closedir(dir);
+	if (!pids)
+		pids = malloc(sizeof(*pids));
+	return pids;
+}
+
+
+bool is_writable(int fdinfo_fd, const char *fd)
+{
+	char buf[256], *s;
+	unsigned int flags;
+	ssize_t n;
+	int info;
+
+	if ((info = openat(fdinfo_fd, fd, O_RDONLY | O_CLOEXEC)) < 0)
+		return false;
+	n = read(info, buf, sizeof(buf) - 1);
+	close(info);
+	if (n <= 0)
+		return false;
+	buf[n] = '\0';
+
+	// pos: ... flags: OCTAL ...
+	return (s = strstr(buf, "flags:")) && sscanf(s, "flags: %o", &flags) == 1 &&
+		(flags & O_ACCMODE) != O_RDONLY;
+}
@@ -0,0 +1,76 @@
+/*
+ * procscan.h
+ *
+ *  Created on: 17.10.2026
+ *      Author: malte
+ */
+
+#pragma once
+#ifndef PROCSCAN_H_
+#define PROCSCAN_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "flagged_int.h"
+
+
+/*
+ * Determines the device of the file system mounted at path. Fails with EINVAL
+ * if path is not a mount point.
+ */
+int mount_device(const char *path, dev_t *dev);
+
+/*
+ * Walks /proc once and pushes every process to pids that has a file on one of
+ * the devices open or mapped, or uses a directory on it as working or root
+ * directory. The processes are distributed among up to thread_count threads;
+ * 0 means one per online CPU. The calling process is never included.
+ *
+ * Returns the amount of pushed PIDs or -1 on error.
+ */
+ssize_t procscan(const dev_t *devices, size_t device_count,
+	struct a_flagged_int *pids, unsigned int thread_count);
+
+/*
+ * Like procscan(), but only looks at the given candidates instead of every
+ * process in /proc.
+ */
+ssize_t procscan_among(const dev_t *devices, size_t device_count,
+	const pid_t *candidates, size_t candidate_count,
+	struct a_flagged_int *pids, unsigned int thread_count);
+
+
+/*
+ * Returns how many regular files a process has open for writing (on one of
+ * the devices, if there are any), or -1 if it's gone or we may not look.
+ */
+ssize_t procscan_writable(pid_t pid, const dev_t *devices, size_t device_count);
+
+
+/*
+ * The scheduler state of a process or thread, i. e. the letter in
+ * /proc/PID/stat ('D' for uninterruptible sleep, 'Z' for zombies, ...), and
+ * the kernel function it sleeps in (empty if it doesn't or we may not see it).
+ */
+struct procscan_state {
+	char state;
+	char wchan[64];
+	pid_t tid;
+};
+
+/*
+ * Fills in the state of a process, i. e. of its leader. Returns false if it's
+ * gone.
+ */
+bool procscan_state(pid_t pid, struct procscan_state *state);
+
+/*
+ * Fills in the state of a thread of a process in uninterruptible sleep,
+ * preferably of TID if it still is, and sets state->tid to the thread. If
+ * none is, it's the state of the leader. Returns false if the process is gone.
+ */
+bool procscan_blocked(pid_t pid, pid_t tid, struct procscan_state *state);
+
+#endif /* PROCSCAN_H_ */
@@ -0,0 +1,190 @@
+/*
+ * proctree.c
+ *
+ *  Created on: 17.10.2026
+ *      Author: malte
+ */
+
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE
+#endif
+#include "proctree.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "utils.h"
+
+
+struct process_parent {
+	pid_t pid, ppid;
+};
+
+
+// forward declarations ===================================
+
+static ssize_t scan_children_files(struct a_flagged_int *pids);
+
+static ssize_t scan_parents(struct a_flagged_int *pids);
+
+static ssize_t push_children(struct a_flagged_int *pids, int task_fd, const char *tid);
+
+static bool is_tracked(struct a_flagged_int *pids, pid_t pid);
+
+
+// implementation =========================================
+
+ssize_t proctree_scan(struct a_flagged_int *pids)
+{
+	// CONFIG_PROC_CHILDREN isn't always there
+	static int children_files = -1;
+	if (children_files < 0)
+		children_files = access("/proc/thread-self/children", R_OK) == 0;
+
+	return children_files ? scan_children_files(pids) : scan_parents(pids);
+}
+
+
+/*
+ * Reads the children of every thread of every valid process. Pushed processes
+ * join the live prefix and are scanned in the same pass.
+ */
+ssize_t scan_children_files(struct a_flagged_int *pids)
+{
+	char path[32];
+	struct dirent *e;
+	ssize_t count = 0, n;
+	size_t i;
+	DIR *d;
+	int fd;
+
+	for (i = 0; i < pids->live; i++) {
+		snprintf(path, sizeof(path), "/proc/%li/task", pids->values[i].i);
+		if ((fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+			continue;
+		if (!(d = fdopendir(fd))) {
+			close(fd);
+			return -1;
+		}
+
+		n = 0;
+		while ((e = readdir(d)) && n >= 0) {
+			if (e->d_name[0] != '.')
+				n = push_children(pids, dirfd(d), e->d_name);
+			count += max(n, 0);
+		}
+		closedir(d);
+		if (n < 0)
+			return -1;
+	}
+	return count;
+}
+
+
+ssize_t push_children(struct a_flagged_int *pids, int task_fd, const char *tid)
+{
+	char path[NAME_MAX + 16];
+	ssize_t count = 0;
+	FILE *f;
+	int fd, pid;
+
+	snprintf(path, sizeof(path), "%s/children", tid);
+	if ((fd = openat(task_fd, path, O_RDONLY | O_CLOEXEC)) < 0)
+		return 0;
+	if (!(f = fdopen(fd, "r"))) {
+		close(fd);
+		return -1;
+	}
+
+	while (fscanf(f, "%i", &pid) == 1) {
+		if (!get_flagged_int(pids, pid)) {
+			if (!push_flagged_int(pids, pid, true)) {
+				count = -1;
+				break;
+			}
+			count++;
+		}
+	}
+	fclose(f);
+	return count;
+}
+
+
+/*
+ * Collects the parent of every process and pushes the descendants of the
+ * tracked ones until no more turn up.
+ */
+ssize_t scan_parents(struct a_flagged_int *pids)
+{
+	struct process_parent *processes = NULL, *p;
+	size_t length = 0, size = 0;
+	const struct dirent *e;
+	char path[32], buf[512], *s, *end;
+	ssize_t count = 0, n;
+	bool changed;
+	long pid;
+	DIR *d;
+	int fd;
+
+	if (!(d = opendir("/proc")))
+		return -1;
+
+	while ((e = readdir(d))) {
+		pid = strtol(e->d_name, &end, 10);
+		if (*end || pid <= 0 || pid > INT_MAX)
+			continue;
+
+		snprintf(path, sizeof(path), "%li/stat", pid);
+		if ((fd = openat(dirfd(d), path, O_RDONLY | O_CLOEXEC)) < 0)
+			continue;
+		n = read(fd, buf, sizeof(buf) - 1);
+		close(fd);
+		if (n <= 0)
+			continue;
+		buf[n] = '\0';
+
+		// PID (COMM) STATE PPID ...; COMM may contain anything
+		if (!(s = strrchr(buf, ')')))
+			continue;
+		if (length >= size) {
+			size = size ? size * 2 : 256;
+			if (!(p = realloc(processes, size * sizeof(*processes)))) {
+				count = -1;
+				break;
+			}
+			processes = p;
+		}
+		p = &processes[length];
+		p->pid = (pid_t) pid;
+		if (sscanf(s + 1, " %*c %i", &p->ppid) == 1)
+			length++;
+	}
+	closedir(d);
+
+	do {
+		changed = false;
+		for (p = processes; count >= 0 && p != processes + length; p++) {
+			if (is_tracked(pids, p->ppid) && !get_flagged_int(pids, p->pid)) {
+				if (!push_flagged_int(pids, p->pid, true)) {
+					count = -1;
+					break;
+				}
+				changed = true;
+				count++;
+			}
+		}
+	} while (changed);
+
+	free(processes);
+	return count;
+}
+
+
+bool is_tracked(struct a_flagged_int *pids, pid_t pid)
+{
+	const struct flagged_int *p = get_flagged_int(pids, pid);
+	return p && p->valid;
+}
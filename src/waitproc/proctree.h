@@ -0,0 +1,27 @@
+/*
+ * proctree.h
+ *
+ *  Created on: 17.10.2026
+ *      Author: malte
+ */
+
+#pragma once
+#ifndef PROCTREE_H_
+#define PROCTREE_H_
+
+#include <sys/types.h>
+
+#include "flagged_int.h"
+
+
+/*
+ * Pushes the descendants of the valid elements of pids that aren't in pids
+ * yet as valid elements in STATE_INITIAL. Uses /proc/PID/task/TID/children
+ * where the kernel provides it and the parent PIDs of all processes
+ * otherwise.
+ *
+ * Returns the amount of pushed PIDs or -1 on error.
+ */
+ssize_t proctree_scan(struct a_flagged_int *pids);
+
+#endif /* PROCTREE_H_ */
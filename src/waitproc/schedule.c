@@ -0,0 +1,164 @@
+/*
+ * schedule.c
+ *
+ *  Created on: 17.10.2026
+ *      Author: malte
+ */
+
+#ifndef _POSIX_C_SOURCE
+	#define _POSIX_C_SOURCE 200112L
+#endif
+#include "schedule.h"
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <assert.h>
+#include "argparse.h"
+#include "utils.h"
+
+
+static const struct signal_name {
+	const char *name;
+	int signal;
+} signal_names[] = {
+	{ "HUP", SIGHUP },
+	{ "INT", SIGINT },
+	{ "QUIT", SIGQUIT },
+	{ "ILL", SIGILL },
+	{ "TRAP", SIGTRAP },
+	{ "ABRT", SIGABRT },
+	{ "BUS", SIGBUS },
+	{ "FPE", SIGFPE },
+	{ "KILL", SIGKILL },
+	{ "USR1", SIGUSR1 },
+	{ "SEGV", SIGSEGV },
+	{ "USR2", SIGUSR2 },
+	{ "PIPE", SIGPIPE },
+	{ "ALRM", SIGALRM },
+	{ "TERM", SIGTERM },
+	{ "CHLD", SIGCHLD },
+	{ "CONT", SIGCONT },
+	{ "STOP", SIGSTOP },
+	{ "TSTP", SIGTSTP },
+	{ "TTIN", SIGTTIN },
+	{ "TTOU", SIGTTOU },
+	{ "URG", SIGURG },
+	{ "XCPU", SIGXCPU },
+	{ "XFSZ", SIGXFSZ },
+	{ "VTALRM", SIGVTALRM },
+	{ "PROF", SIGPROF },
+	{ "WINCH", SIGWINCH },
+	{ "IO", SIGIO },
+	{ "SYS", SIGSYS }
+};
+
+
+int schedule_parse(struct schedule *s, const char *spec)
+{
+	const char *stage = spec, *stage_end, *at;
+	char offset[32];
+	long offset_ms;
+	int signal;
+
+	do {
+		stage_end = stage + strcspn(stage, ",");
+		at = memchr(stage, '@', (size_t)(stage_end - stage));
+
+		signal = signal_from_name(stage, (size_t)((at ? at : stage_end) - stage));
+		if (signal < 0) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		offset_ms = 0;
+		if (at) {
+			if ((size_t)(stage_end - at) > sizeof(offset)) {
+				errno = EINVAL;
+				return -1;
+			}
+			memcpy(offset, at + 1, (size_t)(stage_end - at - 1));
+			offset[stage_end - at - 1] = '\0';
+			if (parse_period(offset, &offset_ms) != 0)
+				return -1;
+			if (offset_ms < 0) {
+				errno = ERANGE;
+				return -1;
+			}
+		}
+
+		if (!schedule_add(s, signal, offset_ms))
+			return -1;
+
+		stage = stage_end + 1;
+	} while (*stage_end);
+
+	return 0;
+}
+
+
+bool schedule_add(struct schedule *s, int signal, long offset_ms)
+{
+	struct schedule_stage *stage;
+
+	if (s->length >= s->size) {
+		size_t size = s->size ? s->size * 2 : 4;
+		if (!(stage = realloc(s->stages, size * sizeof(*stage))))
+			return false;
+		s->stages = stage;
+		s->size = size;
+	}
+
+	// keep the stages ordered; stages with equal offsets keep their order
+	for (stage = s->stages + s->length; stage != s->stages && stage[-1].offset_ms > offset_ms; stage--)
+		*stage = stage[-1];
+	stage->signal = signal;
+	stage->offset_ms = offset_ms;
+	s->length++;
+
+	return true;
+}
+
+
+void schedule_free(struct schedule *s)
+{
+	free(s->stages);
+	memset(s, 0, sizeof(*s));
+}
+
+
+int signal_from_name(const char *name, size_t length)
+{
+	const struct signal_name *n;
+	char *end;
+	long signal;
+
+	if (length >= 3 && !strncasecmp(name, "SIG", 3)) {
+		name += 3;
+		length -= 3;
+	}
+
+	if (inrange(*name, '0', '9' + 1)) {
+		signal = strtol(name, &end, 10);
+		return ((size_t)(end - name) == length && inrange(signal, 1, SIGRTMAX + 1)) ? (int) signal : -1;
+	}
+
+	for (n = signal_names; n != array_end(signal_names); n++) {
+		if (strlen(n->name) == length && !strncasecmp(name, n->name, length))
+			return n->signal;
+	}
+
+	return -1;
+}
+
+
+const char *signal_name(int signal)
+{
+	const struct signal_name *n;
+	for (n = signal_names; n != array_end(signal_names); n++) {
+		if (n->signal == signal)
+			return n->name;
+	}
+	return NULL;
+}
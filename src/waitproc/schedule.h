@@ -0,0 +1,50 @@
+/*
+ * schedule.h
+ *
+ *  Created on: 17.10.2026
+ *      Author: malte
+ */
+
+#pragma once
+#ifndef SCHEDULE_H_
+#define SCHEDULE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+
+struct schedule_stage {
+	int signal;
+	long offset_ms;
+};
+
+
+/*
+ * Signals to send at certain offsets from the start of the waiting period,
+ * ordered by offset.
+ */
+struct schedule {
+	struct schedule_stage *stages;
+	size_t length, size;
+};
+
+
+/*
+ * Parses a comma-separated list of stages like "TERM@0,INT@500ms,KILL@3s" and
+ * adds them to the schedule. A stage without an offset happens immediately.
+ */
+int schedule_parse(struct schedule *s, const char *spec);
+
+bool schedule_add(struct schedule *s, int signal, long offset_ms);
+
+void schedule_free(struct schedule *s);
+
+/*
+ * Accepts signal names with or without "SIG" prefix as well as numbers.
+ * Returns -1 for unknown signals.
+ */
+int signal_from_name(const char *name, size_t length);
+
+const char *signal_name(int signal);
+
+#endif /* SCHEDULE_H_ */
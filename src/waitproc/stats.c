@@ -0,0 +1,178 @@
+/*
+ * stats.c
+ *
+ *  Created on: 17.10.2026
+ *      Author: malte
+ */
+
+#ifndef _POSIX_C_SOURCE
+	#define _POSIX_C_SOURCE 200112L
+#endif
+#include "stats.h"
+#include <sys/wait.h>
+#include "schedule.h"
+#include "utils.h"
+
+
+// buckets with upper bounds of 1, 2, 4, ..., 65536 ms and one for the rest
+#define HISTOGRAM_BUCKETS 18
+
+
+struct histogram {
+	const char *name;
+	unsigned long counts[HISTOGRAM_BUCKETS];
+};
+
+
+// forward declarations ===================================
+
+static void histogram_add(struct histogram *h, double ms);
+
+static void histogram_write(FILE *f, const struct histogram *h);
+
+static void write_time(FILE *f, const char *name, const struct timespec *t, const struct timespec *start);
+
+static const char *state_name(enum flagged_state state);
+
+static const char *cause_name(enum flagged_cause cause);
+
+
+// implementation =========================================
+
+bool stats_write(FILE *f, const struct stats_run *run, struct a_flagged_int *pids)
+{
+	struct histogram attach = { "attach_ms", { 0 } }, termination = { "termination_ms", { 0 } };
+	const struct flagged_int *p, *p_end;
+	const struct timespec *termination_start;
+	const char *signal;
+
+	fprintf(f,
+		"{\n"
+		"\t\"started_at\": %.3f,\n",
+		(double) run->start_realtime.tv_sec + (double) run->start_realtime.tv_nsec * 1e-9);
+	// no engine ran when --mount found nothing to wait for
+	if (run->engine) {
+		fprintf(f, "\t\"engine\": \"%s\",\n", run->engine);
+	} else {
+		fputs("\t\"engine\": null,\n", f);
+	}
+	fprintf(f,
+		"\t\"interval_ms\": %ld,\n"
+		"\t\"processes\": [",
+		run->interval_ms);
+
+	p_end = pids->values ? a_flagged_int_end(pids) : NULL;
+	for (p = pids->values; p != p_end; p++) {
+		fprintf(f, "%s\n\t\t{ \"pid\": %li", (p == pids->values) ? "" : ",", p->i);
+		write_time(f, "attach_ms", &p->attached, &run->start);
+		write_time(f, "signal_ms", &p->signalled, &run->start);
+		if (p->signal && (signal = signal_name(p->signal))) {
+			fprintf(f, ", \"signal\": \"%s\"", signal);
+		} else {
+			fprintf(f, ", \"signal\": %s", p->signal ? "\"?\"" : "null");
+		}
+		write_time(f, "exit_ms", &p->exited, &run->start);
+
+		if (p->cause == CAUSE_NONE) {
+			fputs(", \"cause\": null", f);
+		} else {
+			fprintf(f, ", \"cause\": \"%s\"", cause_name(p->cause));
+		}
+		if (p->status >= 0 && WIFEXITED(p->status)) {
+			fprintf(f, ", \"exit_code\": %i", WEXITSTATUS(p->status));
+		} else if (p->status >= 0 && WIFSIGNALED(p->status)) {
+			signal = signal_name(WTERMSIG(p->status));
+			if (signal) {
+				fprintf(f, ", \"exit_signal\": \"%s\"", signal);
+			} else {
+				fprintf(f, ", \"exit_signal\": %i", WTERMSIG(p->status));
+			}
+		}
+		fprintf(f, ", \"state\": \"%s\" }", state_name(p->state));
+
+		if (!timespec_iszero(&p->attached))
+			histogram_add(&attach, timespec_subtract(&p->attached, &run->start) * 1e3);
+		termination_start = !timespec_iszero(&p->signalled) ? &p->signalled : &p->attached;
+		if (!timespec_iszero(&p->exited) && !timespec_iszero(termination_start))
+			histogram_add(&termination, timespec_subtract(&p->exited, termination_start) * 1e3);
+	}
+
+	fputs("\n\t],\n\t\"histograms\": {\n", f);
+	histogram_write(f, &attach);
+	fputs(",\n", f);
+	histogram_write(f, &termination);
+	fputs("\n\t}\n}\n", f);
+
+	return !ferror(f);
+}
+
+
+void histogram_add(struct histogram *h, double ms)
+{
+	double bound = 1;
+	size_t i = 0;
+	while (i < HISTOGRAM_BUCKETS - 1 && ms >= bound) {
+		bound *= 2;
+		i++;
+	}
+	h->counts[i]++;
+}
+
+
+void histogram_write(FILE *f, const struct histogram *h)
+{
+	size_t i;
+
+	fprintf(f, "\t\t\"%s\": {\n\t\t\t\"le\": [", h->name);
+	for (i = 0; i < HISTOGRAM_BUCKETS - 1; i++)
+		fprintf(f, "%lu, ", 1UL << i);
+	fputs("null],\n\t\t\t\"counts\": [", f);
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+		fprintf(f, i ? ", %lu" : "%lu", h->counts[i]);
+	fputs("]\n\t\t}", f);
+}
+
+
+void write_time(FILE *f, const char *name, const struct timespec *t, const struct timespec *start)
+{
+	if (timespec_iszero(t)) {
+		fprintf(f, ", \"%s\": null", name);
+	} else {
+		fprintf(f, ", \"%s\": %.3f", name, timespec_subtract(t, start) * 1e3);
+	}
+}
+
+
+const char *state_name(enum flagged_state state)
+{
+	switch (state) {
+		case STATE_UNMODIFIED:
+		case STATE_INITIAL:
+			return "initial";
+		case STATE_ATTACHED:
+			return "attached";
+		case STATE_CONTINUED:
+			return "continued";
+		case STATE_DETACHED:
+			return "detached";
+		case STATE_TERMINATED:
+			return "terminated";
+	}
+	return "?";
+}
+
+
+const char *cause_name(enum flagged_cause cause)
+{
+	switch (cause) {
+		case CAUSE_NONE:
+			return NULL;
+		case CAUSE_EXITED:
+			return "exited";
+		case CAUSE_KILLED:
+			return "killed";
+		case CAUSE_VANISHED:
+			return "vanished";
+	}
+	return "?";
+}
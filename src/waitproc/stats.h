@@ -0,0 +1,33 @@
+/*
+ * stats.h
+ *
+ *  Created on: 17.10.2026
+ *      Author: malte
+ */
+
+#pragma once
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "flagged_int.h"
+
+
+struct stats_run {
+	struct timespec start, start_realtime;
+	const char *engine;	// NULL if we didn't wait
+	long interval_ms;
+};
+
+
+/*
+ * Writes a JSON document with the timeline of every process in pids and
+ * histograms of the attach and termination latencies. All times are in
+ * milliseconds since run->start.
+ */
+bool stats_write(FILE *f, const struct stats_run *run, struct a_flagged_int *pids);
+
+#endif /* STATS_H_ */
@@ -0,0 +1,426 @@
+/*
+ * tracker.c
+ *
+ *  Created on: 17.10.2026
+ *      Author: malte
+ */
+
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE
+#endif
+#include "tracker.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/fanotify.h>
+#include "utils.h"
+#include "procscan.h"
+#include "proctree.h"
+#include "volumes.h"
+
+
+// don't bother pruning small indexes
+#ifndef TRACKER_PRUNE_MIN
+#	define TRACKER_PRUNE_MIN 256U
+#endif
+
+
+/*
+ * The index of a tracked file system. It only grows between prunings, which
+ * drop the processes that don't use the device anymore.
+ */
+struct tracked_mount {
+	dev_t dev;
+	int fanotify_fd;
+	struct a_flagged_int pids;
+	size_t pruned_length;
+	bool seen;
+};
+
+/*
+ * The descriptors go into the epoll set of the caller; polling mountinfo
+ * resets its change notification, so it doesn't work through another layer.
+ */
+static
+struct tracker {
+	int epoll_fd, mounts_fd;
+	uint64_t event_data;
+	struct tracked_mount *mounts;
+	size_t length, size;
+}
+tracker = { .epoll_fd = -1, .mounts_fd = -1 };
+
+
+// forward declarations ===================================
+
+static bool tracker_add(int fd, uint32_t events);
+
+static void update_mounts(void);
+
+static bool track_mount(const char *path, dev_t dev);
+
+static void untrack_mount(struct tracked_mount *m);
+
+static void read_events(struct tracked_mount *m);
+
+static void seed(struct tracked_mount *m);
+
+static void prune(struct tracked_mount *m);
+
+static struct tracked_mount *find_mount(dev_t dev);
+
+static struct tracked_mount *find_mount_fd(int fd);
+
+
+// implementation =========================================
+
+bool tracker_open(int epoll_fd, uint64_t event_data)
+{
+	int fd;
+
+	// fail early without the permission to use fanotify
+	if ((fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC, O_RDONLY)) < 0)
+		return false;
+	close(fd);
+
+	tracker.epoll_fd = epoll_fd;
+	tracker.event_data = event_data;
+	if ((tracker.mounts_fd = open("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC)) < 0 ||
+		!tracker_add(tracker.mounts_fd, EPOLLPRI))
+	{
+		tracker_free();
+		return false;
+	}
+
+	update_mounts();
+	return true;
+}
+
+
+void tracker_handle(int fd)
+{
+	struct tracked_mount *m;
+
+	if (fd == tracker.mounts_fd) {
+		update_mounts();
+	} else if ((m = find_mount_fd(fd))) {
+		read_events(m);
+	}
+}
+
+
+void tracker_update()
+{
+	struct pollfd pfd = { tracker.mounts_fd, POLLPRI, 0 };
+	struct tracked_mount *m;
+
+	if (tracker.mounts_fd < 0)
+		return;
+	if (poll(&pfd, 1, 0) > 0)
+		update_mounts();
+	for (m = tracker.mounts; m != tracker.mounts + tracker.length; m++)
+		read_events(m);
+}
+
+
+void tracker_close()
+{
+	struct tracked_mount *m;
+
+	for (m = tracker.mounts; m != tracker.mounts + tracker.length; m++) {
+		if (m->fanotify_fd >= 0) {
+			close(m->fanotify_fd);
+			m->fanotify_fd = -1;
+		}
+	}
+	if (tracker.mounts_fd >= 0) {
+		close(tracker.mounts_fd);
+		tracker.mounts_fd = -1;
+	}
+	tracker.epoll_fd = -1;
+}
+
+
+void tracker_free()
+{
+	tracker_close();
+	while (tracker.length)
+		untrack_mount(tracker.mounts);
+	free(tracker.mounts);
+	tracker.mounts = NULL;
+	tracker.size = 0;
+}
+
+
+bool tracker_covers(dev_t dev)
+{
+	return find_mount(dev) != NULL;
+}
+
+
+ssize_t tracker_blockers(const dev_t *devices, size_t device_count,
+	struct a_flagged_int *pids)
+{
+	struct a_flagged_int candidates;
+	const struct tracked_mount *m;
+	const struct flagged_int *p;
+	pid_t *array = NULL;
+	ssize_t found = -1;
+	bool ok = true;
+	size_t i;
+
+	memset(&candidates, 0, sizeof(candidates));
+	if (!a_flagged_int_init(&candidates, 0))
+		return -1;
+
+	for (i = 0; ok && i < device_count; i++) {
+		if (!(m = find_mount(devices[i])))
+			continue;
+		for (p = m->pids.values; ok && p != m->pids.values + m->pids.length; p++)
+			ok = push_flagged_int(&candidates, p->i, true);
+	}
+
+	// children inherit open files without opening them
+	if (ok && proctree_scan(&candidates) >= 0 &&
+		(array = malloc(max(candidates.length, 1U) * sizeof(*array))))
+	{
+		for (i = 0; i < candidates.length; i++)
+			array[i] = (pid_t) candidates.values[i].i;
+		found = procscan_among(devices, device_count, array, candidates.length, pids, 0);
+	}
+
+	free(array);
+	a_flagged_int_free(&candidates);
+	return found;
+}
+
+
+/*
+ * Prefers file handles to descriptors in the events, so we never hold files on
+ * the file systems open, and falls back for file systems and kernels without
+ * them (or without file system marks).
+ */
+int tracker_watch(char *const *paths, size_t count)
+{
+	static const unsigned int reports[] = { FAN_REPORT_FID, 0 };
+	static const unsigned int marks[] = { FAN_MARK_FILESYSTEM, FAN_MARK_MOUNT };
+
+	const unsigned int *report, *mark;
+	int fd, error = 0;
+	size_t i;
+
+	for (report = reports; report != array_end(reports); report++) {
+		fd = fanotify_init(
+			FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_UNLIMITED_QUEUE | *report,
+			O_RDONLY | O_LARGEFILE | O_CLOEXEC);
+		if (fd < 0) {
+			error = errno;
+			continue;
+		}
+		for (i = 0; i < count; i++) {
+			for (mark = marks; mark != array_end(marks); mark++) {
+				if (fanotify_mark(fd, FAN_MARK_ADD | *mark, FAN_OPEN | FAN_ONDIR, AT_FDCWD, paths[i]) == 0)
+					break;
+				error = errno;
+			}
+			if (mark == array_end(marks))
+				break;
+		}
+		if (i == count)
+			return fd;
+		close(fd);
+	}
+
+	errno = error;
+	return -1;
+}
+
+
+bool tracker_read(int fd, struct a_flagged_int *pids)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct fanotify_event_metadata))));
+	const struct fanotify_event_metadata *e;
+	const pid_t self = getpid();
+	bool complete = true;
+	ssize_t n;
+
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		for (e = (const struct fanotify_event_metadata*) buf; FAN_EVENT_OK(e, n); e = FAN_EVENT_NEXT(e, n)) {
+			if (e->vers != FANOTIFY_METADATA_VERSION)
+				continue;
+			if (e->fd >= 0)
+				close(e->fd);
+			if (e->mask & FAN_Q_OVERFLOW) {
+				complete = false;
+			} else if (e->pid != self && !push_flagged_int(pids, e->pid, true)) {
+				// we lost track just like on an overflow
+				complete = false;
+			}
+		}
+	}
+	return complete;
+}
+
+
+bool tracker_add(int fd, uint32_t events)
+{
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = events;
+	event.data.u64 = tracker.event_data | (uint32_t) fd;
+	return epoll_ctl(tracker.epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+
+/*
+ * Tracks the volumes that were mounted and forgets the unmounted ones.
+ */
+void update_mounts()
+{
+	struct a_volume volumes = { 0 };
+	const struct volume *v;
+	struct tracked_mount *m;
+	dev_t dev;
+
+	if (volumes_list(&volumes) < 0) {
+		warn("Listing the volumes");
+		volumes_free(&volumes);
+		return;
+	}
+
+	for (m = tracker.mounts; m != tracker.mounts + tracker.length; m++)
+		m->seen = false;
+
+	for (v = volumes.values; v != volumes.values + volumes.length; v++) {
+		if (!v->mount_point || mount_device(v->mount_point, &dev) != 0)
+			continue;
+		if ((m = find_mount(dev))) {
+			m->seen = true;
+		} else if (!track_mount(v->mount_point, dev)) {
+			warn("Tracking %s", v->mount_point);
+		}
+	}
+
+	for (m = tracker.mounts; m != tracker.mounts + tracker.length; ) {
+		if (!m->seen) {
+			untrack_mount(m);
+		} else {
+			m++;
+		}
+	}
+
+	volumes_free(&volumes);
+}
+
+
+bool track_mount(const char *path, dev_t dev)
+{
+	struct tracked_mount *m;
+
+	if (tracker.length >= tracker.size) {
+		size_t size = tracker.size ? tracker.size * 2 : 4;
+		if (!(m = realloc(tracker.mounts, size * sizeof(*m))))
+			return false;
+		tracker.mounts = m;
+		tracker.size = size;
+	}
+
+	m = &tracker.mounts[tracker.length];
+	memset(m, 0, sizeof(*m));
+	m->dev = dev;
+	m->seen = true;
+	if ((m->fanotify_fd = tracker_watch((char**) &path, 1)) < 0)
+		return false;
+	if (!a_flagged_int_init(&m->pids, 0) ||
+		!tracker_add(m->fanotify_fd, EPOLLIN))
+	{
+		close(m->fanotify_fd);
+		a_flagged_int_free(&m->pids);
+		return false;
+	}
+	tracker.length++;
+
+	// after marking, so nobody slips through in between
+	seed(m);
+	return true;
+}
+
+
+void untrack_mount(struct tracked_mount *m)
+{
+	if (m->fanotify_fd >= 0)
+		close(m->fanotify_fd);
+	a_flagged_int_free(&m->pids);
+	*m = tracker.mounts[--tracker.length];
+}
+
+
+void read_events(struct tracked_mount *m)
+{
+	if (!tracker_read(m->fanotify_fd, &m->pids))
+		seed(m);
+	if (m->pids.length >= 2 * max(m->pruned_length, TRACKER_PRUNE_MIN))
+		prune(m);
+}
+
+
+void seed(struct tracked_mount *m)
+{
+	if (procscan(&m->dev, 1, &m->pids, 0) < 0)
+		warn("Scanning /proc");
+	m->pruned_length = m->pids.length;
+}
+
+
+void prune(struct tracked_mount *m)
+{
+	struct a_flagged_int pids;
+	pid_t *array;
+	size_t i;
+
+	memset(&pids, 0, sizeof(pids));
+	if (!(array = malloc(m->pids.length * sizeof(*array))) || !a_flagged_int_init(&pids, 0)) {
+		free(array);
+		return;
+	}
+	for (i = 0; i < m->pids.length; i++)
+		array[i] = (pid_t) m->pids.values[i].i;
+
+	if (procscan_among(&m->dev, 1, array, m->pids.length, &pids, 1) >= 0) {
+		a_flagged_int_free(&m->pids);
+		m->pids = pids;
+	} else {
+		a_flagged_int_free(&pids);
+	}
+	m->pruned_length = m->pids.length;
+	free(array);
+}
+
+
+struct tracked_mount *find_mount(dev_t dev)
+{
+	struct tracked_mount *m;
+	for (m = tracker.mounts; m != tracker.mounts + tracker.length; m++) {
+		if (m->dev == dev)
+			return m;
+	}
+	return NULL;
+}
+
+
+struct tracked_mount *find_mount_fd(int fd)
+{
+	struct tracked_mount *m;
+	for (m = tracker.mounts; m != tracker.mounts + tracker.length; m++) {
+		if (m->fanotify_fd == fd)
+			return m;
+	}
+	return NULL;
+}
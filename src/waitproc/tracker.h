@@ -0,0 +1,75 @@
+/*
+ * tracker.h
+ *
+ *  Created on: 17.10.2026
+ *      Author: malte
+ */
+
+#pragma once
+#ifndef TRACKER_H_
+#define TRACKER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "flagged_int.h"
+
+
+/*
+ * Starts tracking the mounted TrueCrypt and VeraCrypt volumes: each of their
+ * file systems gets a fanotify mark, and every process that opens a file or
+ * directory on one enters its index. The index starts out with a procscan()
+ * of the device and follows the mount table from then on.
+ *
+ * The tracker adds its descriptors to epoll_fd with the event data
+ * event_data | fd; pass their events to tracker_handle(). Fails with EPERM
+ * without CAP_SYS_ADMIN.
+ */
+bool tracker_open(int epoll_fd, uint64_t event_data);
+
+void tracker_handle(int fd);
+
+/*
+ * Handles all pending changes of the mount table and file system events.
+ */
+void tracker_update(void);
+
+/*
+ * Closes the descriptors (but leaves the epoll set alone) and keeps the index
+ * for tracker_blockers().
+ */
+void tracker_close(void);
+
+void tracker_free(void);
+
+bool tracker_covers(dev_t dev);
+
+/*
+ * Pushes the processes that use one of the tracked devices like procscan(),
+ * but only looks at the indexed processes and their descendants, which may
+ * have inherited open files. Processes that never opened anything on the
+ * device (e. g. that only changed their working directory there) aren't
+ * found.
+ *
+ * Returns the amount of pushed PIDs or -1 on error.
+ */
+ssize_t tracker_blockers(const dev_t *devices, size_t device_count,
+	struct a_flagged_int *pids);
+
+/*
+ * Returns a non-blocking fanotify descriptor that reports the processes that
+ * open a file or directory on one of the file systems mounted at paths, or -1
+ * on error.
+ */
+int tracker_watch(char *const *paths, size_t count);
+
+/*
+ * Pushes the PIDs of the pending events of a tracker_watch() descriptor to
+ * pids, except our own. Returns false if some got lost, e. g. because the
+ * event queue overflowed.
+ */
+bool tracker_read(int fd, struct a_flagged_int *pids);
+
+#endif /* TRACKER_H_ */
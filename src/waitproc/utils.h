@@ -39,6 +39,12 @@ bool timespec_iszero(const struct timespec *t);
 static inline
 double timespec_subtract(const struct timespec *x, const struct timespec *y);
 
+static inline
+void timespec_add_ms(struct timespec *t, long ms);
+
+static inline
+long timespec_remaining_ms(const struct timespec *deadline);
+
 static inline
 bool streq(const char *a, const char *b);
 
@@ -86,6 +92,34 @@ double timespec_subtract(const struct timespec *x, const struct timespec *y)
 }
 
 
+void timespec_add_ms(struct timespec *t, long ms)
+{
+	t->tv_sec += ms / 1000;
+	t->tv_nsec += ms % 1000 * 1000000L;
+	if (t->tv_nsec >= 1000000000L) {
+		t->tv_sec++;
+		t->tv_nsec -= 1000000000L;
+	}
+}
+
+
+/*
+ * Returns the milliseconds left until a CLOCK_MONOTONIC deadline, 0 once it
+ * passed, or LONG_MAX for none (zero).
+ */
+long timespec_remaining_ms(const struct timespec *deadline)
+{
+	struct timespec now;
+	double left;
+
+	if (timespec_iszero(deadline))
+		return LONG_MAX;
+	VOID(clock_gettime(CLOCK_MONOTONIC, &now));
+	left = timespec_subtract(deadline, &now) * 1e3;
+	return (left > 0) ? (long) left : 0;
+}
+
+
 bool streq(const char *a, const char *b)
 {
 	return strcmp(a, b) == 0;
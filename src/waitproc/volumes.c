@@ -0,0 +1,715 @@
+/*
+ * volumes.c
+ *
+ *  Created on: 17.10.2026
+ *      Author: malte
+ */
+
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE
+#endif
+#include "volumes.h"
+#include <argp.h>
+#include <dirent.h>
+#include <mntent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <err.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <linux/dm-ioctl.h>
+#include <linux/loop.h>
+#include "utils.h"
+
+
+#ifndef SYS_BLOCK
+#	define SYS_BLOCK "/sys/block"
+#endif
+#ifndef UTAB
+#	define UTAB "/run/mount/utab"
+#endif
+
+// device-mapper stacks are at most this deep (cipher cascades, partitions on loops)
+#define MAX_SLAVE_DEPTH 8
+
+// how often to retry removing a busy device
+#define DM_REMOVE_RETRY_MS 100
+
+
+static const char *const flavours[] = { "veracrypt", "truecrypt" };
+
+
+enum volume_column {
+	COLUMN_SLOT,
+	COLUMN_DEVICE,
+	COLUMN_MAPPER,
+	COLUMN_MOUNTPOINT,
+	COLUMN_HELPER,
+	_COLUMN_COUNT
+};
+
+static const char *const column_names[] = {
+	"SLOT", "DEVICE", "MAPPER", "MOUNTPOINT", "HELPER"
+};
+
+
+static
+struct volumes_options {
+	enum volume_column columns[_COLUMN_COUNT * 2];
+	size_t column_count;
+	char **specs;
+	size_t spec_count;
+}
+volumes_options;
+
+
+// forward declarations ===================================
+
+static const char *slot_flavour(const char *name, const char *infix, unsigned int *slot);
+
+static struct volume *volume_for_slot(struct a_volume *volumes, const char *flavour, unsigned int slot);
+
+static char *read_sysfs(const char *path);
+
+static char *backing_device(const char *dm_name);
+
+static size_t mapper_stack(const struct volume *v, char names[][DM_NAME_LEN], char *loop, size_t loop_size);
+
+static int remove_mapper(int control_fd, const char *name, long busy_ms);
+
+static bool scan_mountinfo(struct a_volume *volumes);
+
+static void unescape_octal(char *s);
+
+static bool same_file(const char *path, const struct stat *st);
+
+static char *find_option(const char *options, const char *name);
+
+static int compare_slots(const void *a, const void *b);
+
+static void print_volume(const struct volume *v);
+
+
+// implementation =========================================
+
+ssize_t volumes_list(struct a_volume *volumes)
+{
+	char path[PATH_MAX], *name, *dev;
+	const char *flavour;
+	struct volume *v;
+	struct dirent *e;
+	unsigned int slot, major_, minor_;
+	DIR *d;
+
+	memset(volumes, 0, sizeof(*volumes));
+	if (!(d = opendir(SYS_BLOCK)))
+		return -1;
+
+	while ((e = readdir(d))) {
+		if (strncmp(e->d_name, "dm-", 3) != 0)
+			continue;
+
+		snprintf(path, sizeof(path), SYS_BLOCK "/%s/dm/name", e->d_name);
+		if (!(name = read_sysfs(path)))
+			continue;
+		// the lower layers of cipher cascades have a suffix like "_1"
+		if (!(flavour = slot_flavour(name, "", &slot)) ||
+			!(v = volume_for_slot(volumes, flavour, slot)))
+		{
+			free(name);
+			continue;
+		}
+
+		snprintf(path, sizeof(path), SYS_BLOCK "/%s/dev", e->d_name);
+		if ((dev = read_sysfs(path)) && sscanf(dev, "%u:%u", &major_, &minor_) == 2)
+			v->mapper_dev = makedev(major_, minor_);
+		free(dev);
+
+		if (asprintf(&v->mapper, "/dev/mapper/%s", name) < 0)
+			v->mapper = NULL;
+		v->device = backing_device(e->d_name);
+		free(name);
+	}
+	closedir(d);
+
+	if (!scan_mountinfo(volumes)) {
+		volumes_free(volumes);
+		return -1;
+	}
+
+	qsort(volumes->values, volumes->length, sizeof(*volumes->values), &compare_slots);
+	return (ssize_t) volumes->length;
+}
+
+
+void volumes_free(struct a_volume *volumes)
+{
+	struct volume *v;
+	for (v = volumes->values; v != volumes->values + volumes->length; v++) {
+		free(v->device);
+		free(v->mapper);
+		free(v->mount_point);
+		free(v->aux_mount_point);
+	}
+	free(volumes->values);
+	memset(volumes, 0, sizeof(*volumes));
+}
+
+
+bool volume_matches(const struct volume *v, const char *spec)
+{
+	struct stat st;
+	return stat(spec, &st) == 0 && (
+		(S_ISBLK(st.st_mode) && st.st_rdev == v->mapper_dev && v->mapper) ||
+		same_file(v->device, &st) ||
+		same_file(v->mapper, &st) ||
+		same_file(v->mount_point, &st));
+}
+
+
+char *volume_helper(const struct volume *v)
+{
+	char *line = NULL, *field, *saveptr, *target = NULL, *options = NULL, *helper = NULL;
+	size_t line_size = 0;
+	int id;
+	struct stat st;
+	struct mntent *m;
+	FILE *f;
+
+	if (!v->mount_point)
+		return NULL;
+
+	// libmount keeps userspace mount options in utab (by mount ID since 2.39)
+	if ((f = fopen(UTAB, "re"))) {
+		while (!helper && getline(&line, &line_size, f) > 0) {
+			id = -1;
+			target = options = NULL;
+			for (field = strtok_r(line, " \n", &saveptr); field; field = strtok_r(NULL, " \n", &saveptr)) {
+				if (strncmp(field, "ID=", 3) == 0) {
+					id = atoi(field + 3);
+				} else if (strncmp(field, "TARGET=", 7) == 0) {
+					target = field + 7;
+					unescape_octal(target);
+				} else if (strncmp(field, "OPTS=", 5) == 0) {
+					options = field + 5;
+				}
+			}
+			if (options && ((id >= 0) ? id == v->mount_id : target && streq(target, v->mount_point)))
+				helper = find_option(options, "helper");
+		}
+		free(line);
+		fclose(f);
+		return helper;
+	}
+
+	// a classic mtab file has them, too
+	if (lstat(_PATH_MOUNTED, &st) == 0 && S_ISREG(st.st_mode) && (f = setmntent(_PATH_MOUNTED, "re"))) {
+		while (!helper && (m = getmntent(f))) {
+			if (streq(m->mnt_dir, v->mount_point))
+				helper = find_option(m->mnt_opts, "helper");
+		}
+		endmntent(f);
+	}
+	return helper;
+}
+
+
+int volume_remove(const struct volume *v, long busy_ms)
+{
+	char names[MAX_SLAVE_DEPTH][DM_NAME_LEN], loop[NAME_MAX + 6] = "";
+	size_t count, i;
+	int fd, r = 0;
+
+	if (!v->mapper) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	count = mapper_stack(v, names, loop, sizeof(loop));
+	if (!count || (fd = open("/dev/mapper/control", O_RDWR | O_CLOEXEC)) < 0)
+		return -1;
+	for (i = 0; i < count && r == 0; i++)
+		r = remove_mapper(fd, names[i], busy_ms);
+	close(fd);
+	if (r != 0)
+		return -1;
+
+	if (*loop) {
+		if ((fd = open(loop, O_RDONLY | O_CLOEXEC)) < 0)
+			return -1;
+		r = ioctl(fd, LOOP_CLR_FD, 0);
+		close(fd);
+		if (r != 0 && errno != ENXIO)
+			return -1;
+	}
+
+	// the TrueCrypt process serving it exits with it
+	if (v->aux_mount_point) {
+		if (umount2(v->aux_mount_point, 0) != 0 && errno != EINVAL && errno != ENOENT)
+			return -1;
+		rmdir(v->aux_mount_point);
+	}
+	return 0;
+}
+
+
+/*
+ * Parses names like "veracrypt3" (infix "") or ".truecrypt_aux_mnt1" (infix
+ * "_aux_mnt", with the leading dot skipped by the caller) and returns the
+ * flavour or NULL.
+ */
+const char *slot_flavour(const char *name, const char *infix, unsigned int *slot)
+{
+	const char *const *f;
+	const char *digits;
+	char *end;
+	unsigned long n;
+
+	for (f = flavours; f != array_end(flavours); f++) {
+		if (strncmp(name, *f, strlen(*f)) != 0)
+			continue;
+		digits = name + strlen(*f);
+		if (strncmp(digits, infix, strlen(infix)) != 0)
+			continue;
+		digits += strlen(infix);
+
+		if (!inrange(*digits, '1', '9' + 1))
+			return NULL;
+		n = strtoul(digits, &end, 10);
+		if (*end || n > UINT_MAX)
+			return NULL;
+		*slot = (unsigned int) n;
+		return *f;
+	}
+	return NULL;
+}
+
+
+struct volume *volume_for_slot(struct a_volume *volumes, const char *flavour, unsigned int slot)
+{
+	struct volume *v;
+
+	for (v = volumes->values; v != volumes->values + volumes->length; v++) {
+		if (v->slot == slot && v->flavour == flavour)
+			return v;
+	}
+
+	if (volumes->length >= volumes->size) {
+		size_t size = volumes->size ? volumes->size * 2 : 8;
+		if (!(v = realloc(volumes->values, size * sizeof(*v))))
+			return NULL;
+		volumes->values = v;
+		volumes->size = size;
+	}
+
+	v = &volumes->values[volumes->length++];
+	memset(v, 0, sizeof(*v));
+	v->slot = slot;
+	v->flavour = flavour;
+	v->mount_id = -1;
+	return v;
+}
+
+
+/*
+ * Returns the first line of a sysfs attribute without the line break.
+ */
+char *read_sysfs(const char *path)
+{
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t length;
+	FILE *f = fopen(path, "re");
+
+	if (!f)
+		return NULL;
+	length = getline(&line, &size, f);
+	fclose(f);
+
+	if (length <= 0) {
+		free(line);
+		return NULL;
+	}
+	if (line[length - 1] == '\n')
+		line[length - 1] = '\0';
+	return line;
+}
+
+
+/*
+ * Follows the slaves of a device-mapper device down to the volume, i. e. the
+ * first block device that isn't device-mapper, or the backing file of a loop
+ * device.
+ */
+char *backing_device(const char *dm_name)
+{
+	char path[PATH_MAX], name[NAME_MAX + 1], *device;
+	struct dirent *e;
+	unsigned int depth;
+	DIR *d;
+
+	snprintf(name, sizeof(name), "%s", dm_name);
+	for (depth = 0; depth < MAX_SLAVE_DEPTH; depth++) {
+		snprintf(path, sizeof(path), SYS_BLOCK "/%s/slaves", name);
+		if (!(d = opendir(path)))
+			return NULL;
+		while ((e = readdir(d)) && e->d_name[0] == '.')
+			;
+		if (!e) {
+			closedir(d);
+			return NULL;
+		}
+		snprintf(name, sizeof(name), "%s", e->d_name);
+		closedir(d);
+
+		if (strncmp(name, "loop", 4) == 0) {
+			snprintf(path, sizeof(path), SYS_BLOCK "/%s/loop/backing_file", name);
+			return read_sysfs(path);
+		}
+		if (strncmp(name, "dm-", 3) != 0)
+			return (asprintf(&device, "/dev/%s", name) >= 0) ? device : NULL;
+	}
+	return NULL;
+}
+
+
+/*
+ * Collects the names of the device-mapper devices of a volume from the mapper
+ * down and the loop device below them, if any. Devices that don't belong to
+ * the volume's slot end the stack. Returns the amount of names.
+ */
+size_t mapper_stack(const struct volume *v, char names[][DM_NAME_LEN], char *loop, size_t loop_size)
+{
+	char path[PATH_MAX], name[NAME_MAX + 1], *dm_name;
+	const char *base = strrchr(v->mapper, '/') + 1;
+	struct dirent *e;
+	size_t count = 0;
+	DIR *d;
+
+	snprintf(name, sizeof(name), "dm-%u", minor(v->mapper_dev));
+	while (count < MAX_SLAVE_DEPTH) {
+		snprintf(path, sizeof(path), SYS_BLOCK "/%s/dm/name", name);
+		if (!(dm_name = read_sysfs(path)))
+			break;
+		// the lower layers of cascades are named like the mapper with a suffix
+		if (strncmp(dm_name, base, strlen(base)) != 0) {
+			free(dm_name);
+			break;
+		}
+		snprintf(names[count++], DM_NAME_LEN, "%s", dm_name);
+		free(dm_name);
+
+		snprintf(path, sizeof(path), SYS_BLOCK "/%s/slaves", name);
+		if (!(d = opendir(path)))
+			break;
+		while ((e = readdir(d)) && e->d_name[0] == '.')
+			;
+		if (e)
+			snprintf(name, sizeof(name), "%s", e->d_name);
+		closedir(d);
+		if (!e)
+			break;
+
+		if (strncmp(name, "loop", 4) == 0) {
+			snprintf(loop, loop_size, "/dev/%s", name);
+			break;
+		}
+		if (strncmp(name, "dm-", 3) != 0)
+			break;
+	}
+	return count;
+}
+
+
+int remove_mapper(int control_fd, const char *name, long busy_ms)
+{
+	const struct timespec delay = { 0, DM_REMOVE_RETRY_MS * 1000000L };
+	struct dm_ioctl io;
+	long retries;
+	int r;
+
+	for (retries = 0; ; retries++) {
+		memset(&io, 0, sizeof(io));
+		io.version[0] = DM_VERSION_MAJOR;
+		io.data_size = sizeof(io);
+		snprintf(io.name, sizeof(io.name), "%s", name);
+		if ((r = ioctl(control_fd, DM_DEV_REMOVE, &io)) == 0 || errno != EBUSY || retries >= busy_ms / DM_REMOVE_RETRY_MS)
+			break;
+		nanosleep(&delay, NULL);
+	}
+	return (r != 0 && errno == ENXIO) ? 0 : r;
+}
+
+
+/*
+ * Finds the mount points of the mapper devices and the auxiliary FUSE mounts
+ * of volumes without one.
+ */
+bool scan_mountinfo(struct a_volume *volumes)
+{
+	char *line = NULL, *fields[16], *saveptr, *base, *source;
+	unsigned int major_, minor_, slot, n;
+	const char *flavour;
+	struct volume *v;
+	struct stat st;
+	size_t line_size = 0, count, separator;
+	dev_t dev;
+	FILE *f;
+
+	if (!(f = fopen("/proc/self/mountinfo", "re")))
+		return false;
+
+	while (getline(&line, &line_size, f) > 0) {
+		count = 0;
+		for (fields[0] = strtok_r(line, " \n", &saveptr); fields[count] && count < elementsof(fields) - 1; )
+			fields[++count] = strtok_r(NULL, " \n", &saveptr);
+
+		// ID PARENT MAJOR:MINOR ROOT MOUNTPOINT OPTIONS [OPTIONAL...] - FSTYPE SOURCE SUPEROPTIONS
+		for (separator = 6; separator < count && !streq(fields[separator], "-"); separator++)
+			;
+		if (separator + 2 >= count || sscanf(fields[2], "%u:%u", &major_, &minor_) != 2)
+			continue;
+		dev = makedev(major_, minor_);
+		unescape_octal(fields[4]);
+		source = fields[separator + 2];
+		unescape_octal(source);
+
+		base = strrchr(fields[4], '/');
+		if (base && base[1] == '.' &&
+			strncmp(fields[separator + 1], "fuse", 4) == 0 &&
+			(flavour = slot_flavour(base + 2, "_aux_mnt", &slot)))
+		{
+			if (!(v = volume_for_slot(volumes, flavour, slot)))
+				break;
+			v->unresolved = !v->mapper;
+			if (!v->aux_mount_point)
+				v->aux_mount_point = strdup(fields[4]);
+			continue;
+		}
+
+		for (n = 0; n < volumes->length; n++) {
+			v = &volumes->values[n];
+			if (!v->mapper || v->mount_point)
+				continue;
+			// btrfs reports anonymous devices, so look at the source as well
+			if (dev == v->mapper_dev || streq(source, v->mapper) || (
+					strncmp(source, "/dev/", 5) == 0 && stat(source, &st) == 0 &&
+					S_ISBLK(st.st_mode) && st.st_rdev == v->mapper_dev
+			)) {
+				v->mount_point = strdup(fields[4]);
+				v->mount_id = atoi(fields[0]);
+				break;
+			}
+		}
+	}
+
+	free(line);
+	fclose(f);
+	return true;
+}
+
+
+/*
+ * Decodes the \ooo escapes of mountinfo and utab in place.
+ */
+void unescape_octal(char *s)
+{
+	char *d = s;
+	for (; *s; s++, d++) {
+		if (s[0] == '\\' && inrange(s[1], '0', '4') && inrange(s[2], '0', '8') && inrange(s[3], '0', '8')) {
+			*d = (char)((s[1] - '0') << 6 | (s[2] - '0') << 3 | (s[3] - '0'));
+			s += 3;
+		} else {
+			*d = *s;
+		}
+	}
+	*d = '\0';
+}
+
+
+bool same_file(const char *path, const struct stat *st)
+{
+	struct stat other;
+	if (!path || stat(path, &other) != 0)
+		return false;
+	if (S_ISBLK(st->st_mode) || S_ISBLK(other.st_mode))
+		return S_ISBLK(st->st_mode) && S_ISBLK(other.st_mode) && st->st_rdev == other.st_rdev;
+	return st->st_dev == other.st_dev && st->st_ino == other.st_ino;
+}
+
+
+/*
+ * Returns the value of option name in a comma-separated list as a new string.
+ */
+char *find_option(const char *options, const char *name)
+{
+	const size_t name_length = strlen(name);
+	const char *o, *end;
+
+	for (o = options; *o; o = *end ? end + 1 : end) {
+		end = o + strcspn(o, ",");
+		if ((size_t)(end - o) > name_length && o[name_length] == '=' && strncmp(o, name, name_length) == 0)
+			return strndup(o + name_length + 1, (size_t)(end - o) - name_length - 1);
+	}
+	return NULL;
+}
+
+
+int compare_slots(const void *a_, const void *b_)
+{
+	const struct volume *a = a_, *b = b_;
+	return (a->slot > b->slot) - (a->slot < b->slot);
+}
+
+
+void print_volume(const struct volume *v)
+{
+	const enum volume_column *c;
+	char *helper;
+
+	if (!volumes_options.column_count) {
+		printf("%u: %s %s %s\n", v->slot,
+			v->device ? v->device : "-", v->mapper ? v->mapper : "-",
+			v->mount_point ? v->mount_point : "-");
+		return;
+	}
+
+	for (c = volumes_options.columns; c != volumes_options.columns + volumes_options.column_count; c++) {
+		if (c != volumes_options.columns)
+			putchar('\t');
+		switch (*c) {
+			case COLUMN_SLOT:
+				printf("%u", v->slot);
+				break;
+			case COLUMN_DEVICE:
+				fputs(v->device ? v->device : "-", stdout);
+				break;
+			case COLUMN_MAPPER:
+				fputs(v->mapper ? v->mapper : "-", stdout);
+				break;
+			case COLUMN_MOUNTPOINT:
+				fputs(v->mount_point ? v->mount_point : "-", stdout);
+				break;
+			case COLUMN_HELPER:
+				helper = volume_helper(v);
+				fputs(helper ? helper : "-", stdout);
+				free(helper);
+				break;
+			case _COLUMN_COUNT:
+				UNEXPECTED_STATE();
+				break;
+		}
+	}
+	putchar('\n');
+}
+
+
+static int parse_option(int key, char *arg, struct argp_state *state)
+{
+	const char *column, *end;
+	size_t i;
+
+	switch (key) {
+	case 'o':
+		for (column = arg; *column; column = *end ? end + 1 : end) {
+			end = column + strcspn(column, ",");
+			for (i = 0; i < _COLUMN_COUNT && !(
+					strlen(column_names[i]) == (size_t)(end - column) &&
+					strncasecmp(column, column_names[i], (size_t)(end - column)) == 0
+				); i++)
+				;
+			if (i == _COLUMN_COUNT)
+				argp_error(state, "Unknown column '%.*s'.", (int)(end - column), column);
+			if (volumes_options.column_count == elementsof(volumes_options.columns))
+				argp_error(state, "Too many columns.");
+			volumes_options.columns[volumes_options.column_count++] = (enum volume_column) i;
+		}
+		break;
+
+	case ARGP_KEY_ARGS:
+		volumes_options.specs = state->argv + state->next;
+		volumes_options.spec_count = (size_t)(state->argc - state->next);
+		break;
+
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+
+	return 0;
+}
+
+
+static struct argp_option const argp_options[] = {
+	{ "output", 'o', "LIST", 0,
+		"Print the comma-separated columns in LIST, separated by tabs, instead of "
+		"the format of `veracrypt -t -l`. Available columns: SLOT, DEVICE, "
+		"MAPPER, MOUNTPOINT, HELPER (the mount helper recorded for the mount "
+		"point). Missing values are printed as \"-\".",
+		0 },
+	{ 0 }
+};
+
+static struct argp const argp = {
+	argp_options, &parse_option,
+	"[VOLUME...]",
+	"Lists the mounted TrueCrypt and VeraCrypt volumes like `veracrypt -t -l`, "
+	"but without starting VeraCrypt. VOLUME may be a volume, its mapper "
+	"device, or its mount point; without it, all volumes are listed.\v"
+	"Volumes mounted with \"nokernelcrypto\" aren't known to device-mapper; "
+	"if there are any, the default output format is left to VeraCrypt.",
+	NULL, NULL, NULL
+};
+
+
+int tc_volumes_main(int argc, char *argv[])
+{
+	struct a_volume volumes;
+	const struct volume *v, *unresolved = NULL;
+	char **exec_argv;
+	size_t i;
+	bool found = false;
+
+	argp_parse(&argp, argc, argv, 0, NULL, NULL);
+
+	if (volumes_list(&volumes) < 0)
+		err(EXIT_FAILURE, "Listing the volumes");
+
+	for (v = volumes.values; v != volumes.values + volumes.length && !unresolved; v++) {
+		if (v->unresolved)
+			unresolved = v;
+	}
+	if (unresolved && !volumes_options.column_count) {
+		// TrueCrypt itself still knows
+		if (!(exec_argv = calloc(volumes_options.spec_count + 4, sizeof(*exec_argv))))
+			err(EXIT_FAILURE, "malloc");
+		exec_argv[0] = (char*) unresolved->flavour;
+		exec_argv[1] = "-t";
+		exec_argv[2] = "-l";
+		memcpy(exec_argv + 3, volumes_options.specs, volumes_options.spec_count * sizeof(*exec_argv));
+		execvp(exec_argv[0], exec_argv);
+		warn("%s", exec_argv[0]);
+		free(exec_argv);
+	}
+
+	for (v = volumes.values; v != volumes.values + volumes.length; v++) {
+		for (i = 0; i < volumes_options.spec_count && !volume_matches(v, volumes_options.specs[i]); i++)
+			;
+		if (!volumes_options.spec_count || i < volumes_options.spec_count) {
+			print_volume(v);
+			found = true;
+		}
+	}
+	volumes_free(&volumes);
+
+	if (!found)
+		warnx(volumes_options.spec_count ? "No such volume is mounted." : "No volumes mounted.");
+	return (found && fflush(stdout) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,77 @@
+/*
+ * volumes.h
+ *
+ *  Created on: 17.10.2026
+ *      Author: malte
+ */
+
+#pragma once
+#ifndef VOLUMES_H_
+#define VOLUMES_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+
+/*
+ * A mounted TrueCrypt or VeraCrypt volume as `veracrypt -t -l` describes it.
+ * device is the volume (a block device or container file), mapper the
+ * decrypted block device, and mount_point is NULL if the latter isn't mounted.
+ * aux_mount_point is the FUSE mount through which TrueCrypt keeps track of
+ * the volume.
+ */
+struct volume {
+	unsigned int slot;
+	const char *flavour;
+	char *device, *mapper, *mount_point, *aux_mount_point;
+	dev_t mapper_dev;
+	int mount_id;
+
+	// only known to TrueCrypt (FUSE-only volumes with "nokernelcrypto")
+	bool unresolved;
+};
+
+
+struct a_volume {
+	struct volume *values;
+	size_t length, size;
+};
+
+
+/*
+ * Builds the volume table from device-mapper in /sys/block, the auxiliary
+ * FUSE mounts of TrueCrypt and /proc/self/mountinfo, ordered by slot.
+ * Returns the amount of volumes or -1 on error.
+ */
+ssize_t volumes_list(struct a_volume *volumes);
+
+void volumes_free(struct a_volume *volumes);
+
+/*
+ * Tells whether spec refers to the volume, its mapper device, or its mount
+ * point like `veracrypt -t -l SPEC` would.
+ */
+bool volume_matches(const struct volume *v, const char *spec);
+
+/*
+ * Returns the mount helper recorded in the userspace mount options (helper=)
+ * of the volume's mount point as a new string or NULL.
+ */
+char *volume_helper(const struct volume *v);
+
+/*
+ * Tears down an unmounted volume like `veracrypt -d`: removes its
+ * device-mapper devices (from the top of a cipher cascade down), detaches the
+ * loop device of a container file, and unmounts the auxiliary FUSE mount.
+ * Busy devices are retried for up to busy_ms. Fails with ENOTSUP for volumes
+ * unknown to device-mapper, which only TrueCrypt can dismount.
+ */
+int volume_remove(const struct volume *v, long busy_ms);
+
+/*
+ * The tc-volumes entry point of the multi-call binary.
+ */
+int tc_volumes_main(int argc, char *argv[]);
+
+#endif /* VOLUMES_H_ */
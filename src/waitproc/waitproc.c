@@ -1,3 +1,6 @@
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE
+#endif
 #ifndef _POSIX_C_SOURCE
 	#define _POSIX_C_SOURCE 200112L
 #endif
@@ -11,11 +14,25 @@
 #include <unistd.h>
 #include <sys/wait.h>
 #include <sys/ptrace.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include <assert.h>
 
 #include "utils.h"
 #include "flagged_int.h"
 #include "argparse.h"
+#include "cgroup.h"
+#include "daemon.h"
+#include "dismount.h"
+#include "pidfd.h"
+#include "procscan.h"
+#include "proctree.h"
+#include "schedule.h"
+#include "stats.h"
+#include "tracker.h"
+#include "volumes.h"
 
 
 #ifndef DEBUG
@@ -32,11 +49,21 @@ typedef unsigned long flag_t;
 static
 struct waitproc_options {
 	struct a_flagged_int pids;
-	long interval_sec;
+	char **mount_points;
+	unsigned int mount_point_count;
+	dev_t *devices;
+	unsigned int device_count;
+	struct a_cgroup cgroups;
+	long interval_ms, deadline_ms, stuck_ms;
+	unsigned long jobs;
+	struct timespec deadline;
+	struct schedule schedule;
+	const char *stats_path;
+	const char *daemon_path, *connect_path;
 	flag_t flags;
 
+	struct stats_run run;
 	struct timespec wait_start;
-	int last_signal;
 }
 waitproc_options = { 0 };
 
@@ -46,7 +73,19 @@ enum waitproc_flags_position {
 	WAITPROC_FLAG_TERMINATE,
 	WAITPROC_FLAG_KILL,
 	WAITPROC_FLAG_QUIET,
-	WAITPROC_FLAG_ALARMSET,
+	WAITPROC_FLAG_PTRACE,
+	WAITPROC_FLAG_MOUNT,
+	WAITPROC_FLAG_WATCH_MOUNT,
+	WAITPROC_FLAG_DISMOUNT,
+	WAITPROC_FLAG_TREE,
+	WAITPROC_FLAG_WRITERS_FIRST,
+	WAITPROC_FLAG_STDIN,
+	WAITPROC_FLAG_NULL,
+	WAITPROC_FLAG_NDJSON,
+	WAITPROC_FLAG_EXIT_STUCK,
+	WAITPROC_FLAG_STUCK,
+	WAITPROC_FLAG_ABORTED,
+	WAITPROC_FLAG_INDEXED,
 	WAITPROC_FLAG_ERROROCCURED,
 	_WAITPROC_FLAG_COUNT
 };
@@ -84,15 +123,100 @@ void waitproc_flags_setc(enum waitproc_flags_position flagpos, bool value)
 	waitproc_options.flags = (waitproc_options.flags & ~mask) | ((flag_t) value << flagpos);
 }
 
+static inline
+void waitproc_flags_setif(enum waitproc_flags_position flagpos, bool value)
+{
+	if (value)
+		waitproc_flags_set(flagpos);
+}
+
+
+enum event_source {
+	EVENT_PROCESS,
+	EVENT_TIMER,
+	EVENT_SIGNAL,
+	EVENT_CGROUP,
+	EVENT_TREE,
+	EVENT_INPUT,
+	EVENT_WATCH,
+	EVENT_TRACEES,
+	EVENT_STUCK
+};
+
+static inline
+uint64_t event_data(enum event_source source, pid_t pid)
+{
+	return ((uint64_t) source << 32) | (uint32_t) pid;
+}
+
+static inline
+enum event_source event_data_source(uint64_t data)
+{
+	return (enum event_source)(data >> 32);
+}
+
+static inline
+pid_t event_data_pid(uint64_t data)
+{
+	return (pid_t)(uint32_t) data;
+}
+
+
+/*
+ * All waiting happens in a single epoll set: pidfds report process exits, a
+ * timerfd the end of the waiting period, and a signalfd SIGCHLD (for ptrace)
+ * as well as requests to stop waiting early.
+ */
+static
+struct event_loop {
+	int epoll_fd, timer_fd, signal_fd, tree_fd, watch_fd, tracees_fd, stuck_fd;
+	sigset_t old_mask;
+
+	int count, terminated, detaching;
+	size_t next_stage, next_writer_stage;
+	bool expired;
+
+	// how to attach to PIDs that turn up while waiting
+	a_flagged_callback attach;
+	unsigned long ptrace_options;
+
+	// PIDs from stdin (--stdin)
+	bool input_open;
+	char input[16];
+	size_t input_length;
+
+	// whether watch_fd reports opens on the mounts or is a timer (--watch-mount)
+	bool watch_opens;
+
+	// when tracees_fd looks for tracees the kernel dropped next (ptrace)
+	long tracees_check_ms;
+}
+event_loop = {
+	.epoll_fd = -1, .timer_fd = -1, .signal_fd = -1, .tree_fd = -1, .watch_fd = -1,
+	.tracees_fd = -1, .stuck_fd = -1
+};
+
+
+bool event_loop_add(int fd, uint32_t events, uint64_t data)
+{
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = events;
+	event.data.u64 = data;
+	return epoll_ctl(event_loop.epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
 
 struct trace_data {
 	int count;
 	enum flagged_state target_state;
 	union {
 		const int *signal;
-		enum __ptrace_request trace_type;
+		unsigned long ptrace_options;
 	} d;
 	bool error_occured;
+	bool unsupported;
+	bool pending;
 };
 
 
@@ -100,10 +224,80 @@ struct trace_data *trace_data_init(struct trace_data *data)
 {
 	data->count = 0;
 	data->error_occured = false;
+	data->unsupported = false;
+	data->pending = false;
 	return data;
 }
 
 
+/*
+ * Starts a line of --format=ndjson with the wall-clock time and the
+ * milliseconds since the start (like --stats).
+ */
+void print_event_start(const char *event)
+{
+	struct timespec now, realtime;
+	verify(clock_gettime(CLOCK_MONOTONIC, &now) == 0);
+	verify(clock_gettime(CLOCK_REALTIME, &realtime) == 0);
+
+	printf("{ \"time\": %.6f, \"elapsed_ms\": %.3f, \"event\": \"%s\"",
+		(double) realtime.tv_sec + (double) realtime.tv_nsec * 1e-9,
+		timespec_subtract(&now, &waitproc_options.run.start) * 1e3, event);
+}
+
+
+// the reader may want to act on it right away
+void print_event_end()
+{
+	puts(" }");
+	fflush(stdout);
+}
+
+
+void print_json_string(const char *s)
+{
+	putchar('"');
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\') {
+			printf("\\%c", *s);
+		} else if ((unsigned char) *s < 0x20) {
+			printf("\\u%04x", (unsigned char) *s);
+		} else {
+			putchar(*s);
+		}
+	}
+	putchar('"');
+}
+
+
+void print_signal_field(const char *name, int signal)
+{
+	const char *s = signal_name(signal);
+	if (s) {
+		printf(", \"%s\": \"%s\"", name, s);
+	} else {
+		printf(", \"%s\": %i", name, signal);
+	}
+}
+
+
+void print_terminated_cgroup(const struct cgroup *c)
+{
+	if (waitproc_flags_test(WAITPROC_FLAG_QUIET))
+		return;
+
+	if (waitproc_flags_test(WAITPROC_FLAG_NDJSON)) {
+		print_event_start("emptied");
+		fputs(", \"cgroup\": ", stdout);
+		print_json_string(c->path);
+		print_event_end();
+	} else {
+		puts(c->path);
+		fflush(stdout);
+	}
+}
+
+
 void print_terminated_process(pid_t pid)
 {
 #if DEBUG
@@ -132,13 +326,129 @@ void print_terminated_process(pid_t pid)
 #endif
 			pid
 		);
+		fflush(stdout);
+
+	}
+}
+
+
+enum process_event {
+	PROCESS_ATTACHED,
+	PROCESS_SIGNALLED,
+	PROCESS_STOPPED,
+	PROCESS_FORWARDED,
+	PROCESS_EXITED,
+	PROCESS_KILLED,
+	PROCESS_VANISHED,
+	PROCESS_DETACHED
+};
+
+static const char *const process_event_names[] = {
+	"attached", "signalled", "stopped", "forwarded", "exited", "killed",
+	"vanished", "detached"
+};
+
+
+/*
+ * Writes a line of --format=ndjson for a state transition of p (see
+ * note_event()).
+ */
+void print_process_event(const struct flagged_int *p, enum process_event event, int detail)
+{
+	print_event_start(process_event_names[event]);
+	printf(", \"pid\": %li", p->i);
+
+	switch (event) {
+		case PROCESS_SIGNALLED:
+		case PROCESS_STOPPED:
+		case PROCESS_FORWARDED:
+			print_signal_field("signal", detail);
+			break;
+
+		case PROCESS_EXITED:
+			if (detail >= 0 && WIFEXITED(detail)) {
+				printf(", \"exit_code\": %i", WEXITSTATUS(detail));
+			} else if (detail >= 0 && WIFSIGNALED(detail)) {
+				print_signal_field("exit_signal", WTERMSIG(detail));
+			}
+			break;
+
+		default:
+			break;
+	}
+	print_event_end();
+}
+
+/*
+ * Records the time of a state transition of p and reports terminations, or
+ * every transition with --format=ndjson. detail is the signal for
+ * PROCESS_SIGNALLED, PROCESS_STOPPED (the intercepted stop signal), and
+ * PROCESS_FORWARDED, and the wait status (or -1) for PROCESS_EXITED.
+ */
+void note_event(struct flagged_int *p, enum process_event event, int detail)
+{
+	struct timespec now;
+	verify(clock_gettime(CLOCK_MONOTONIC, &now) == 0);
+
+	switch (event) {
+		case PROCESS_ATTACHED:
+			p->attached = now;
+			break;
+
+		case PROCESS_SIGNALLED:
+			if (!p->signal) {
+				p->signalled = now;
+				p->signal = detail;
+			}
+			break;
+
+		case PROCESS_EXITED:
+		case PROCESS_KILLED:
+		case PROCESS_VANISHED:
+			p->exited = now;
+			p->status = (event == PROCESS_EXITED) ? detail : -1;
+			p->cause =
+				(event == PROCESS_EXITED) ? CAUSE_EXITED :
+				(event == PROCESS_KILLED) ? CAUSE_KILLED :
+				CAUSE_VANISHED;
+			if (!waitproc_flags_test(WAITPROC_FLAG_NDJSON))
+				print_terminated_process((pid_t) p->i);
+			break;
 
+		case PROCESS_STOPPED:
+		case PROCESS_FORWARDED:
+		case PROCESS_DETACHED:
+			break;
 	}
+
+	if (waitproc_flags_test(WAITPROC_FLAG_NDJSON) && !waitproc_flags_test(WAITPROC_FLAG_QUIET))
+		print_process_event(p, event, detail);
 }
 
 
 #define SIGINVALID -1
 
+#define DETACH_TIMEOUT_MS 1000
+
+// how often the pidfd engine looks for new descendants with --tree
+#define TREE_SCAN_INTERVAL_MS 100
+
+// how often to scan the mounts for new users without fanotify (--watch-mount)
+#define WATCH_SCAN_INTERVAL_MS 250
+
+// how much of --deadline tc-dismount keeps for after the waiting at most
+#define DEADLINE_RESERVE_MS 1000
+
+// how often to look for processes in uninterruptible sleep at most (--stuck)
+#define STUCK_SCAN_INTERVAL_MS 250
+
+// the exit status when we gave up on them (--exit-stuck)
+#define EXIT_STUCK DISMOUNT_WAIT_STUCK
+
+// how soon and how often at most to look for tracees the kernel dropped
+#define TRACEES_CHECK_MIN_MS 10
+#define TRACEES_CHECK_MAX_MS 1000
+
 
 bool send_signal(struct flagged_int *p, void *data_)
 {
@@ -148,17 +458,32 @@ bool send_signal(struct flagged_int *p, void *data_)
 
 	if (inrange(p->state, STATE_ATTACHED, STATE_DETACHED)) {
 		for (signal = data->d.signal; *signal != SIGINVALID; signal++) {
-			if (kill((pid_t) p->i, *signal) == 0) {
-				p->state = data->target_state;
+			if (((p->fd >= 0) ?
+					sys_pidfd_send_signal(p->fd, *signal, NULL, 0) :
+					kill((pid_t) p->i, *signal)
+				) == 0
+			) {
+				if (data->target_state != STATE_UNMODIFIED)
+					p->state = data->target_state;
 				if (data->target_state == STATE_TERMINATED) p->valid = false;
+				note_event(p, PROCESS_SIGNALLED, *signal);
 				count++;
 			} else {
+				if (p->fd >= 0 && errno == ESRCH) {
+					// the pidfd becomes readable and reports the exit
+					break;
+				}
 				p->valid = false;
 				switch (errno) {
 					case ESRCH:
 						p->state = STATE_TERMINATED;
 						break;
 
+					case EPERM:
+						warnx("No permission to send signals to PID %li.", p->i);
+						data->error_occured = true;
+						break;
+
 					default:
 						assert(errno != EINVAL);
 						UNEXPECTED_STATE();
@@ -176,19 +501,24 @@ bool send_signal(struct flagged_int *p, void *data_)
 }
 
 
+/*
+ * Seizes p without stopping it, so it goes on running (and may handle signals)
+ * right away.
+ */
 bool attach_process(struct flagged_int *p, void *data_)
 {
 	struct trace_data *data = (struct trace_data*) data_;
 	if (p->state < STATE_ATTACHED) {
-		if (ptrace(PTRACE_ATTACH, (pid_t) p->i, 0, 0) == 0) {
-			p->state = STATE_ATTACHED;
+		if (ptrace(PTRACE_SEIZE, (pid_t) p->i, 0, data->d.ptrace_options) == 0) {
+			p->state = STATE_CONTINUED;
+			note_event(p, PROCESS_ATTACHED, 0);
 			data->count++;
 		} else {
 			p->valid = false;
 			switch (errno) {
 				case ESRCH:
 					p->state = STATE_TERMINATED;
-					print_terminated_process((pid_t) p->i);
+					note_event(p, PROCESS_VANISHED, 0);
 					break;
 
 				case EPERM:
@@ -207,221 +537,1526 @@ bool attach_process(struct flagged_int *p, void *data_)
 }
 
 
+bool is_zombie(pid_t pid)
+{
+	struct procscan_state s;
+	return !procscan_state(pid, &s) || strchr("ZX", s.state);
+}
+
+
+/*
+ * When a thread other than the leader calls execve(), it takes over the PID of
+ * its thread group, and the kernel drops the traced leader without reporting
+ * an exit. So we attach again to the processes that aren't our tracees anymore
+ * without having reported their exit, if they're still there. The leader
+ * exits first, which is all we get to hear of it; meanwhile it's a zombie.
+ */
+bool reattach_process(struct flagged_int *p, void *data_)
+{
+	struct trace_data *data = (struct trace_data*) data_;
+	siginfo_t info;
+
+	if (p->state != STATE_CONTINUED)
+		return true;
+	if (waitid(P_PID, (id_t) p->i, &info, WEXITED | WSTOPPED | WNOHANG | WNOWAIT | __WALL) == 0) {
+		// still ours, but a zombie leader may be on its way out
+		data->pending |= is_zombie((pid_t) p->i);
+		return true;
+	}
+	if (!is_zombie((pid_t) p->i)) {
+		if (ptrace(PTRACE_SEIZE, (pid_t) p->i, 0, event_loop.ptrace_options) == 0) {
+			data->count++;
+			return true;
+		}
+		if (errno == EPERM) {
+			warnx("No permission to attach to PID %li again.", p->i);
+			data->error_occured = true;
+		}
+	}
+
+	p->state = STATE_TERMINATED;
+	p->valid = false;
+	note_event(p, PROCESS_EXITED, -1);
+	event_loop.terminated++;
+	return true;
+}
+
+
+/*
+ * Kills p or interrupts it, so it can be detached once it reports the
+ * interruption (see handle_wait()). data->count counts the processes that were
+ * killed or need to be detached.
+ */
 bool detach_process(struct flagged_int *p, void *data_)
 {
 	struct trace_data *data = (struct trace_data*) data_;
 	if (p->state < data->target_state) {
 		long r;
 		if (p->state < STATE_ATTACHED) {
-			r = 0;
+			p->state = data->target_state;
+			return true;
+		}
+
+		if (data->target_state == STATE_TERMINATED) {
+			r = kill((pid_t) p->i, SIGKILL);
 		} else {
-			if (p->state >= STATE_CONTINUED) {
-				r = kill((pid_t) p->i, SIGSTOP);
-				if (r != 0 && errno == ESRCH) {
-					p->state = STATE_TERMINATED;
-					p->valid = false;
-					print_terminated_process((pid_t) p->i);
-					return true;
-				}
-				assert(r == 0);
-			}
-			r = ptrace(data->d.trace_type, (pid_t) p->i, 0, 0);
+			r = ptrace(PTRACE_INTERRUPT, (pid_t) p->i, 0, 0);
 		}
 
 		if (r == 0) {
-			p->state = data->target_state;
-			if (data->target_state == STATE_TERMINATED)
-				print_terminated_process((pid_t) p->i);
+			if (data->target_state == STATE_TERMINATED) {
+				p->state = STATE_TERMINATED;
+				note_event(p, PROCESS_KILLED, 0);
+			}
+			data->count++;
+		} else if (errno == ESRCH) {
+			// already dead; its exit is still waiting to be reaped
+			if (data->target_state == STATE_TERMINATED) {
+				p->state = STATE_TERMINATED;
+				note_event(p, PROCESS_EXITED, -1);
+			}
 			data->count++;
 		} else {
 			p->valid = false;
 			data->error_occured = true;
-			perror("ptrace attach");
+			perror((data->target_state == STATE_TERMINATED) ? "kill" : "ptrace interrupt");
 		}
 	}
 	return true;
 }
 
 
-void signal_handler_store_signum(int signal)
+bool open_process(struct flagged_int *p, void *data_)
 {
-	waitproc_options.last_signal = signal;
+	struct trace_data *data = (struct trace_data*) data_;
+	if (p->state < STATE_ATTACHED) {
+		int fd = sys_pidfd_open((pid_t) p->i, 0);
+		if (fd >= 0) {
+			if (!event_loop_add(fd, EPOLLIN, event_data(EVENT_PROCESS, (pid_t) p->i))) {
+				perror("epoll_ctl");
+				close(fd);
+				p->valid = false;
+				data->error_occured = true;
+				return true;
+			}
+			p->fd = fd;
+			p->state = STATE_ATTACHED;
+			note_event(p, PROCESS_ATTACHED, 0);
+			data->count++;
+		} else {
+			switch (errno) {
+				case ENOSYS:
+					data->unsupported = true;
+					return false;
+
+				case ESRCH:
+					p->valid = false;
+					p->state = STATE_TERMINATED;
+					note_event(p, PROCESS_VANISHED, 0);
+					break;
+
+				case EINVAL:
+					p->valid = false;
+					warnx("PID %li is not a process (thread group leader).", p->i);
+					data->error_occured = true;
+					break;
+
+				default:
+					p->valid = false;
+					data->error_occured = true;
+					perror("pidfd_open");
+					break;
+			}
+		}
+	}
+	return true;
 }
 
 
-void set_alarm()
+bool release_process(struct flagged_int *p, void *data_)
 {
-	assert(!waitproc_flags_test(WAITPROC_FLAG_ALARMSET) && timespec_iszero(&waitproc_options.wait_start));
+	struct trace_data *data = (struct trace_data*) data_;
+	if (p->fd >= 0) {
+		if (p->state < data->target_state) {
+			if (data->target_state == STATE_TERMINATED &&
+				sys_pidfd_send_signal(p->fd, SIGKILL, NULL, 0) != 0 &&
+				errno != ESRCH
+			) {
+				p->valid = false;
+				data->error_occured = true;
+				perror("pidfd_send_signal");
+			} else {
+				p->state = data->target_state;
+				if (data->target_state == STATE_TERMINATED) {
+					p->valid = false;
+					note_event(p, PROCESS_KILLED, 0);
+				} else {
+					note_event(p, PROCESS_DETACHED, 0);
+				}
+				data->count++;
+			}
+		}
+		close(p->fd);
+		p->fd = -1;
+	}
+	return true;
+}
 
-	verify(clock_gettime(CLOCK_MONOTONIC, &waitproc_options.wait_start) == 0);
 
-	if (waitproc_options.interval_sec) {
-		struct sigaction action;
-		memset(&action, 0, sizeof(action));
-		action.sa_handler = &signal_handler_store_signum;
+void raise_nofile_limit()
+{
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+}
+
 
-		waitproc_options.last_signal = SIGINVALID;
-		sigaction(SIGALRM, &action, NULL);
-		assert(inrange(waitproc_options.interval_sec, 1, UINT_MAX+1));
-		alarm((unsigned int) waitproc_options.interval_sec);
-		waitproc_flags_set(WAITPROC_FLAG_ALARMSET);
+bool event_loop_init(bool child_signals)
+{
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, DAEMON_ABORT_SIGNAL);
+	if (child_signals)
+		sigaddset(&signals, SIGCHLD);
+
+	event_loop.count = event_loop.terminated = event_loop.detaching = 0;
+	event_loop.next_stage = event_loop.next_writer_stage = 0;
+	event_loop.expired = false;
+	event_loop.input_open = false;
+	event_loop.input_length = 0;
+	event_loop.watch_opens = false;
+	event_loop.tracees_check_ms = TRACEES_CHECK_MIN_MS;
+	memset(&waitproc_options.wait_start, 0, sizeof(waitproc_options.wait_start));
+
+	if ((event_loop.epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+		(event_loop.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0 ||
+		sigprocmask(SIG_BLOCK, &signals, &event_loop.old_mask) != 0 ||
+		(event_loop.signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC)) < 0 ||
+		!event_loop_add(event_loop.timer_fd, EPOLLIN, event_data(EVENT_TIMER, 0)) ||
+		!event_loop_add(event_loop.signal_fd, EPOLLIN, event_data(EVENT_SIGNAL, 0)) ||
+		(child_signals && (
+			(event_loop.tracees_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0 ||
+			!event_loop_add(event_loop.tracees_fd, EPOLLIN, event_data(EVENT_TRACEES, 0))))
+	) {
+		perror("Setting up the event loop");
+		return false;
 	}
+
+	return true;
 }
 
 
-bool handle_wait(pid_t pid, int status, int count, int *continued, int *terminated)
+void event_loop_free()
 {
-	unsigned int alarm_remaining_sec = waitproc_flags_test(WAITPROC_FLAG_ALARMSET) ? alarm(0) : 0;
+	int *fd;
+	for (fd = &event_loop.epoll_fd; fd <= &event_loop.stuck_fd; fd++) {
+		if (*fd >= 0) {
+			close(*fd);
+			*fd = -1;
+		}
+	}
+	sigprocmask(SIG_SETMASK, &event_loop.old_mask, NULL);
+}
 
-	if (pid != -1) {
-		struct flagged_int *p = get_flagged_int(&waitproc_options.pids, pid);
-		assert(p);
 
-		if (WIFSTOPPED(status)) {
-			long r = WSTOPSIG(status);
-			assert(p->valid);
-			switch (r) {
-				case SIGSTOP:
-					if (p->state == STATE_ATTACHED) {
-						p->state = STATE_CONTINUED;
-						r = 0;
-						assert(*continued < count);
-						if (++(*continued) == count)
-							set_alarm();
-					} else {
-						r = SIGCONT;
-					}
-					break;
+/*
+ * Opens the cgroups and adds the populated ones to the event loop. Returns the
+ * amount of cgroups to wait for; empty ones count as terminated right away.
+ */
+int open_cgroups()
+{
+	struct cgroup *c;
+	int count = 0;
 
-				case SIGTSTP:
-					r = SIGCONT;
-					break;
+	for (c = waitproc_options.cgroups.values; c != waitproc_options.cgroups.values + waitproc_options.cgroups.length; c++) {
+		if (!cgroup_open(c)) {
+			warn("%s", c->path);
+			waitproc_flags_set(WAITPROC_FLAG_ERROROCCURED);
+			continue;
+		}
+		if (c->populated && !event_loop_add(c->events_fd, EPOLLPRI,
+				event_data(EVENT_CGROUP, (pid_t)(c - waitproc_options.cgroups.values))))
+		{
+			perror("epoll_ctl");
+			waitproc_flags_set(WAITPROC_FLAG_ERROROCCURED);
+			cgroup_close(c);
+			continue;
+		}
 
-				default:
-					// forward the signal
-					break;
-			}
-			if (r >= 0) {
-				assert(p->state >= STATE_ATTACHED);
-				r = ptrace(PTRACE_CONT, pid, 0, r);
-				assert(r == 0);
-			}
-		} else if (WIFEXITED(status) || WIFSIGNALED(status)) {
-			assert(p->valid && p->state < STATE_TERMINATED);
-			p->state = STATE_TERMINATED;
-			p->valid = false;
-			print_terminated_process(pid);
-			if (++(*terminated) == count)
-				return false;
-		}
-	} else switch (errno) {
-		case EINTR:
-			if (waitproc_options.last_signal == SIGALRM) {
-				waitproc_options.last_signal = SIGINVALID;
-				if (DEBUG || !alarm_remaining_sec)
-					return false;
-			} else {
-				fputs("Interrupted by unexpected signal\n", stderr);
-				UNEXPECTED_STATE();
-			}
-			break;
+		count++;
+		if (!c->populated) {
+			print_terminated_cgroup(c);
+			cgroup_close(c);
+			event_loop.terminated++;
+		}
+	}
+	return count;
+}
 
-		case ECHILD:
-			*terminated = count;
-			return false;
 
-		default:
-			UNEXPECTED_STATE();
-			break;
+void signal_cgroups(int signal)
+{
+	struct cgroup *c;
+	for (c = waitproc_options.cgroups.values; c != waitproc_options.cgroups.values + waitproc_options.cgroups.length; c++) {
+		if (c->events_fd >= 0 && c->populated && cgroup_signal(c, signal) < 0) {
+			warn("Signalling %s", c->path);
+			waitproc_flags_set(WAITPROC_FLAG_ERROROCCURED);
+		}
 	}
+}
 
-	assert(*terminated < count);
 
-	if (alarm_remaining_sec)
-		alarm(alarm_remaining_sec);
+/*
+ * Kills the cgroups that are still populated if requested and closes them all.
+ */
+void release_cgroups(bool kill)
+{
+	struct cgroup *c;
 
-	return true;
+	if (kill)
+		signal_cgroups(SIGKILL);
+	for (c = waitproc_options.cgroups.values; c != waitproc_options.cgroups.values + waitproc_options.cgroups.length; c++)
+		cgroup_close(c);
 }
 
 
-static const int termination_signals[] = { SIGHUP, SIGTERM, SIGINVALID };
+/*
+ * Tells whether p has regular files open for writing (on the mount points
+ * with --mount), so it belongs with the writers (--writers-first).
+ */
+void find_writer(struct flagged_int *p)
+{
+	p->writer = procscan_writable((pid_t) p->i,
+		waitproc_options.devices, waitproc_options.device_count) > 0;
+}
 
-int wait_pids()
+
+/*
+ * Sends p the signals of the schedule stages that already ran, so a process
+ * that turned up while waiting catches up with the others. With
+ * --writers-first, it joins the writers or the others first.
+ */
+void catch_up(struct flagged_int *p)
 {
 	struct trace_data data;
-	int count, continued, terminated;
-	pid_t pid; int wait_status;
+	int signals[] = { SIGINVALID, SIGINVALID };
+	size_t i, stages;
+
+	// before the first signal, find_writers() looks at everyone at once
+	if (waitproc_flags_test(WAITPROC_FLAG_WRITERS_FIRST) && !timespec_iszero(&waitproc_options.wait_start))
+		find_writer(p);
+	stages = p->writer ? event_loop.next_writer_stage : event_loop.next_stage;
+
+	data.target_state = STATE_UNMODIFIED;
+	data.d.signal = signals;
+	for (i = 0; i < stages && p->valid; i++) {
+		signals[0] = waitproc_options.schedule.stages[i].signal;
+		send_signal(p, trace_data_init(&data));
+		waitproc_flags_setif(WAITPROC_FLAG_ERROROCCURED, data.error_occured);
+	}
+}
 
-	a_flagged_each(&waitproc_options.pids, &attach_process, trace_data_init(&data));
-	waitproc_flags_setc(WAITPROC_FLAG_ERROROCCURED, data.error_occured);
-	if (data.count <= 0)
-		return data.count;
-	count = data.count;
-
-	if (waitproc_flags_test(WAITPROC_FLAG_TERMINATE)) {
-		data.target_state = STATE_ATTACHED;
-		data.d.signal = termination_signals;
-		a_flagged_each(&waitproc_options.pids, &send_signal, trace_data_init(&data));
-		waitproc_flags_setc(WAITPROC_FLAG_ERROROCCURED, data.error_occured);
-		if (data.count <= 0)
-			return data.count;
-	}
-
-	continued = 0;
-	terminated = 0;
-	do {
-		pid = waitpid(-1, &wait_status, WUNTRACED);
-	} while (handle_wait(pid, wait_status, count, &continued, &terminated));
 
-	if (waitproc_flags_test(WAITPROC_FLAG_KILL)) {
-		data.target_state = STATE_TERMINATED;
-		data.d.trace_type = PTRACE_KILL;
-		terminated = count;
+/*
+ * Adds a process that the kernel attached to us because a traced process
+ * forked it (--tree with ptrace).
+ */
+struct flagged_int *track_child(pid_t pid)
+{
+	struct flagged_int *p = get_flagged_int(&waitproc_options.pids, pid);
+	if (p)
+		return p;
+
+	if (!push_flagged_int(&waitproc_options.pids, pid, true)) {
+		perror("malloc");
+		waitproc_flags_set(WAITPROC_FLAG_ERROROCCURED);
+		return NULL;
+	}
+	p = get_flagged_int(&waitproc_options.pids, pid);
+	p->state = STATE_CONTINUED;
+	note_event(p, PROCESS_ATTACHED, 0);
+
+	event_loop.count++;
+	if (event_loop.detaching) {
+		event_loop.detaching++;
 	} else {
-		data.target_state = STATE_DETACHED;
-		data.d.trace_type = PTRACE_DETACH;
+		catch_up(p);
 	}
-	a_flagged_each(&waitproc_options.pids, &detach_process, trace_data_init(&data));
-	waitproc_flags_setc(WAITPROC_FLAG_ERROROCCURED, data.error_occured);
+	return p;
+}
 
-	return terminated;
+
+/*
+ * Attaches to p like event_loop.attach and lets it catch up with the signals
+ * the others got already if it's new.
+ */
+bool attach_late(struct flagged_int *p, void *data_)
+{
+	struct trace_data *data = (struct trace_data*) data_;
+	const int count = data->count;
+	const bool r = event_loop.attach(p, data);
+
+	if (data->count > count)
+		catch_up(p);
+	return r;
 }
 
 
-int parse_pids(unsigned int argc, char *argv[])
+/*
+ * Attaches to the descendants of the tracked processes until no new ones turn
+ * up and returns how many it attached to.
+ */
+int attach_descendants(struct trace_data *data)
 {
-	unsigned int argp;
-	int pid, charcount;
+	int count = 0;
+	ssize_t found;
 
-	for (argp = 0; argp < argc; argp++) {
-		if (sscanf(argv[argp], "%i%n", &pid, &charcount) > 0 && !argv[argp][charcount]) {
-			push_flagged_int(&waitproc_options.pids, pid, true);
+	do {
+		if ((found = proctree_scan(&waitproc_options.pids)) < 0) {
+			perror("Scanning the process tree");
+			waitproc_flags_set(WAITPROC_FLAG_ERROROCCURED);
 		}
-	}
+		a_flagged_each(&waitproc_options.pids, &attach_late, trace_data_init(data));
+		waitproc_flags_setif(WAITPROC_FLAG_ERROROCCURED, data->error_occured);
+		count += data->count;
+	} while (found > 0);
 
-	return (int) min(waitproc_options.pids.length, (size_t)INT_MAX);
+	return count;
 }
 
 
-int parse_options(int key, char *arg, struct argp_state *state)
+/*
+ * The pidfd engine has no fork notifications and looks for new descendants
+ * periodically and before each signal.
+ */
+void scan_tree()
 {
-	int r;
+	struct trace_data data;
+	event_loop.count += attach_descendants(&data);
+}
 
-	if ((r = argp_action_wrapper(key, arg, state)) != ARGP_ERR_UNKNOWN) {
-		switch (key) {
-		case 'i':
-			if (r == EINVAL || !inrange(waitproc_options.interval_sec, 1, UINT_MAX+1)) {
-				argp_error(state, "'%s' is not a time period from 1 to %u seconds.", arg, UINT_MAX);
-				return EINVAL;
-			}
-			break;
-		}
-		return r;
+
+bool start_tree_scan()
+{
+	const struct itimerspec period = {
+		{ TREE_SCAN_INTERVAL_MS / 1000, TREE_SCAN_INTERVAL_MS % 1000 * 1000000L },
+		{ TREE_SCAN_INTERVAL_MS / 1000, TREE_SCAN_INTERVAL_MS % 1000 * 1000000L }
+	};
+
+	if ((event_loop.tree_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0 ||
+		timerfd_settime(event_loop.tree_fd, 0, &period, NULL) != 0 ||
+		!event_loop_add(event_loop.tree_fd, EPOLLIN, event_data(EVENT_TREE, 0)))
+	{
+		perror("Setting up the process tree scan");
+		return false;
+	}
+	return true;
+}
+
+
+bool parse_pid(const char *s, int *pid)
+{
+	int charcount;
+	return sscanf(s, "%i%n", pid, &charcount) > 0 && !s[charcount];
+}
+
+
+/*
+ * Attaches to a PID that turned up while waiting (on stdin or on a watched
+ * mount) and sends it the signals of the schedule stages that already ran, so
+ * it catches up with the others.
+ */
+void add_pid(int pid)
+{
+	struct trace_data data;
+	struct flagged_int *p;
+
+	if (get_flagged_int(&waitproc_options.pids, pid))
+		return;
+	if (!push_flagged_int(&waitproc_options.pids, pid, true)) {
+		perror("malloc");
+		waitproc_flags_set(WAITPROC_FLAG_ERROROCCURED);
+		return;
+	}
+	p = get_flagged_int(&waitproc_options.pids, pid);
+
+	data.d.ptrace_options = event_loop.ptrace_options;
+	event_loop.attach(p, trace_data_init(&data));
+	waitproc_flags_setif(WAITPROC_FLAG_ERROROCCURED, data.error_occured);
+	event_loop.count += data.count;
+	catch_up(p);
+}
+
+
+/*
+ * Follows new PIDs with their descendants (--tree).
+ */
+void add_descendants()
+{
+	struct trace_data data;
+
+	if (waitproc_flags_test(WAITPROC_FLAG_TREE)) {
+		data.d.ptrace_options = event_loop.ptrace_options;
+		event_loop.count += attach_descendants(&data);
+	}
+}
+
+
+static inline
+bool is_input_delimiter(char c)
+{
+	return waitproc_flags_test(WAITPROC_FLAG_NULL) ? c == '\0' : (c == ' ' || inrange(c, '\t', '\r' + 1));
+}
+
+
+/*
+ * Takes the PIDs from the next chunk of stdin. A PID may span chunks; the
+ * unfinished rest waits in event_loop.input.
+ */
+void read_input()
+{
+	char buf[4096], *s, *end, *token;
+	ssize_t n;
+	int pid;
+
+	memcpy(buf, event_loop.input, event_loop.input_length);
+	n = read(STDIN_FILENO, buf + event_loop.input_length, sizeof(buf) - event_loop.input_length - 1);
+	if (n < 0) {
+		if (errno == EINTR || errno == EAGAIN)
+			return;
+		perror("Reading PIDs from stdin");
+		waitproc_flags_set(WAITPROC_FLAG_ERROROCCURED);
+	}
+	end = buf + event_loop.input_length + max(n, 0);
+
+	for (s = token = buf; s != end; s++) {
+		if (is_input_delimiter(*s)) {
+			*s = '\0';
+			if (token != s && parse_pid(token, &pid))
+				add_pid(pid);
+			token = s + 1;
+		}
+	}
+
+	if (n > 0) {
+		// a longer token isn't a PID anyway; cut it short
+		event_loop.input_length = min((size_t)(end - token), sizeof(event_loop.input) - 1);
+		memcpy(event_loop.input, token, event_loop.input_length);
+	} else {
+		*end = '\0';
+		if (token != end && parse_pid(token, &pid))
+			add_pid(pid);
+		event_loop.input_length = 0;
+		event_loop.input_open = false;
+		epoll_ctl(event_loop.epoll_fd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+	}
+
+	add_descendants();
+}
+
+
+/*
+ * Regular files don't work with epoll, but never block either, so we read
+ * them right away.
+ */
+void start_input()
+{
+	event_loop.input_open = true;
+
+	if (!event_loop_add(STDIN_FILENO, EPOLLIN, event_data(EVENT_INPUT, 0))) {
+		if (errno != EPERM) {
+			perror("Reading PIDs from stdin");
+			waitproc_flags_set(WAITPROC_FLAG_ERROROCCURED);
+			event_loop.input_open = false;
+			return;
+		}
+		while (event_loop.input_open)
+			read_input();
+	}
+}
+
+
+/*
+ * Attaches to the processes that use one of the watched mounts, either among
+ * the candidates or, without any, among all processes. Returns how many of
+ * them are new.
+ */
+int add_mount_blockers(const pid_t *candidates, size_t candidate_count)
+{
+	struct a_flagged_int found;
+	const struct flagged_int *p;
+	const int count = event_loop.count;
+	ssize_t r;
+
+	memset(&found, 0, sizeof(found));
+	if (!a_flagged_int_init(&found, 0)) {
+		perror("malloc");
+		waitproc_flags_set(WAITPROC_FLAG_ERROROCCURED);
+		return 0;
+	}
+
+	r = candidates ?
+		procscan_among(waitproc_options.devices, waitproc_options.device_count,
+			candidates, candidate_count, &found, 1) :
+		procscan(waitproc_options.devices, waitproc_options.device_count, &found, 0);
+	if (r < 0) {
+		perror("Scanning /proc");
+		waitproc_flags_set(WAITPROC_FLAG_ERROROCCURED);
+	}
+	for (p = found.values; p != found.values + found.length; p++)
+		add_pid((int) p->i);
+	if (found.length)
+		add_descendants();
+
+	a_flagged_int_free(&found);
+	return event_loop.count - count;
+}
+
+
+/*
+ * Looks at the processes that opened something on the watched mounts since
+ * the last time, or at all of them if fanotify lost track or the watch is a
+ * timer.
+ */
+void read_watch()
+{
+	struct a_flagged_int opened;
+	const struct flagged_int *p;
+	pid_t *candidates;
+	size_t count = 0;
+	uint64_t expirations;
+
+	if (!event_loop.watch_opens) {
+		if (read(event_loop.watch_fd, &expirations, sizeof(expirations)) > 0)
+			add_mount_blockers(NULL, 0);
+		return;
+	}
+
+	memset(&opened, 0, sizeof(opened));
+	if (!a_flagged_int_init(&opened, 0) || !tracker_read(event_loop.watch_fd, &opened) ||
+		!(candidates = malloc(max(opened.length, 1U) * sizeof(*candidates)))
+	) {
+		a_flagged_int_free(&opened);
+		add_mount_blockers(NULL, 0);
+		return;
+	}
+
+	for (p = opened.values; p != opened.values + opened.length; p++) {
+		if (!get_flagged_int(&waitproc_options.pids, (int) p->i))
+			candidates[count++] = (pid_t) p->i;
+	}
+	// they may have closed the file already
+	if (count)
+		add_mount_blockers(candidates, count);
+
+	free(candidates);
+	a_flagged_int_free(&opened);
+}
+
+
+/*
+ * Watches the mounts for processes that start using them while we wait: with
+ * fanotify as root, with a periodic scan otherwise.
+ */
+bool start_watch()
+{
+	const struct itimerspec period = {
+		{ WATCH_SCAN_INTERVAL_MS / 1000, WATCH_SCAN_INTERVAL_MS % 1000 * 1000000L },
+		{ WATCH_SCAN_INTERVAL_MS / 1000, WATCH_SCAN_INTERVAL_MS % 1000 * 1000000L }
+	};
+
+	event_loop.watch_fd = tracker_watch(waitproc_options.mount_points, waitproc_options.mount_point_count);
+	event_loop.watch_opens = event_loop.watch_fd >= 0;
+	if ((!event_loop.watch_opens && (
+			(event_loop.watch_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0 ||
+			timerfd_settime(event_loop.watch_fd, 0, &period, NULL) != 0)) ||
+		!event_loop_add(event_loop.watch_fd, EPOLLIN, event_data(EVENT_WATCH, 0)))
+	{
+		perror("Watching the mount points");
+		return false;
+	}
+
+	// whoever came along since the first scan
+	if (event_loop.watch_opens)
+		add_mount_blockers(NULL, 0);
+	return true;
+}
+
+
+/*
+ * Reports p once one of its threads has been in uninterruptible sleep for
+ * --stuck. A process that is shutting down may pass through it, but not for
+ * that long unless its I/O hangs; signals, even SIGKILL, don't get through
+ * until it returns. data->count counts the stuck processes.
+ */
+bool check_stuck(struct flagged_int *p, void *data_)
+{
+	struct trace_data *data = (struct trace_data*) data_;
+	struct procscan_state s;
+	struct timespec now;
+
+	// any thread will do, e. g. one blocked in a flush while the leader waits
+	if (!procscan_blocked((pid_t) p->i, p->blocked_tid, &s) || s.state != 'D') {
+		memset(&p->uninterruptible, 0, sizeof(p->uninterruptible));
+		p->blocked_tid = 0;
+		p->stuck = false;
+		return true;
+	}
+
+	verify(clock_gettime(CLOCK_MONOTONIC, &now) == 0);
+	if (timespec_iszero(&p->uninterruptible) || s.tid != p->blocked_tid) {
+		p->uninterruptible = now;
+		p->blocked_tid = s.tid;
+		p->stuck = false;
+	}
+	if (timespec_subtract(&now, &p->uninterruptible) * 1e3 < (double) waitproc_options.stuck_ms)
+		return true;
+
+	data->count++;
+	if (p->stuck)
+		return true;
+	p->stuck = true;
+	if (waitproc_flags_test(WAITPROC_FLAG_NDJSON)) {
+		if (!waitproc_flags_test(WAITPROC_FLAG_QUIET)) {
+			print_event_start("stuck");
+			printf(", \"pid\": %li, \"tid\": %li, \"wchan\": ", p->i, (long) s.tid);
+			print_json_string(s.wchan);
+			print_event_end();
+		}
+	} else {
+		if (s.tid != (pid_t) p->i) {
+			warnx("PID %li is stuck in uninterruptible sleep (thread %li)%s%s.", p->i,
+				(long) s.tid, *s.wchan ? " in " : "", s.wchan);
+		} else {
+			warnx("PID %li is stuck in uninterruptible sleep%s%s.", p->i,
+				*s.wchan ? " in " : "", s.wchan);
+		}
+	}
+	return true;
+}
+
+
+/*
+ * Looks for stuck processes and, with --exit-stuck, stops waiting once only
+ * stuck ones are left.
+ */
+void scan_stuck()
+{
+	struct trace_data data;
+
+	a_flagged_each(&waitproc_options.pids, &check_stuck, trace_data_init(&data));
+	if (waitproc_flags_test(WAITPROC_FLAG_EXIT_STUCK) && data.count &&
+		data.count >= event_loop.count - event_loop.terminated && !event_loop.input_open)
+	{
+		waitproc_flags_set(WAITPROC_FLAG_STUCK);
+		event_loop.expired = true;
+	}
+}
+
+
+bool start_stuck_scan()
+{
+	const long interval_ms = min(waitproc_options.stuck_ms, STUCK_SCAN_INTERVAL_MS);
+	const struct itimerspec period = {
+		{ interval_ms / 1000, interval_ms % 1000 * 1000000L },
+		{ interval_ms / 1000, interval_ms % 1000 * 1000000L }
+	};
+
+	if ((event_loop.stuck_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0 ||
+		timerfd_settime(event_loop.stuck_fd, 0, &period, NULL) != 0 ||
+		!event_loop_add(event_loop.stuck_fd, EPOLLIN, event_data(EVENT_STUCK, 0)))
+	{
+		perror("Setting up the scan for stuck processes");
+		return false;
+	}
+	return true;
+}
+
+
+/*
+ * Whether we're done: every process terminated and no more may turn up. With
+ * --watch-mount, or if the blockers came from the daemon's index, a last scan
+ * makes sure the mounts are idle.
+ */
+bool is_done()
+{
+	return event_loop.terminated >= event_loop.count && !event_loop.input_open &&
+		((event_loop.watch_fd < 0 && !waitproc_flags_test(WAITPROC_FLAG_INDEXED)) ||
+			add_mount_blockers(NULL, 0) <= 0);
+}
+
+
+/*
+ * Splits the processes into writers and others before the first signal
+ * (--writers-first); the ones that turn up later follow in catch_up().
+ */
+void find_writers()
+{
+	struct flagged_int *p;
+
+	for (p = waitproc_options.pids.values; p != waitproc_options.pids.values + waitproc_options.pids.live; p++)
+		find_writer(p);
+}
+
+
+bool signal_writer(struct flagged_int *p, void *data)
+{
+	return !p->writer || send_signal(p, data);
+}
+
+
+bool signal_other(struct flagged_int *p, void *data)
+{
+	return p->writer || send_signal(p, data);
+}
+
+
+/*
+ * Returns when a stage reaches the writers (--writers-first). The stages at
+ * the start of the schedule do so on time, the later ones only halfway to
+ * the next stage or the end of the waiting period, so the writers get a larger
+ * share of the grace period to flush their files.
+ */
+long writer_offset_ms(size_t index)
+{
+	const struct schedule *schedule = &waitproc_options.schedule;
+	const long offset_ms = schedule->stages[index].offset_ms;
+	const long next_ms = (index + 1 < schedule->length) ?
+		schedule->stages[index + 1].offset_ms : waitproc_options.interval_ms;
+
+	if (offset_ms <= schedule->stages[0].offset_ms || next_ms <= offset_ms)
+		return offset_ms;
+	return offset_ms + (next_ms - offset_ms) / 2;
+}
+
+
+void run_stage(const struct schedule_stage *stage, a_flagged_callback signal)
+{
+	struct trace_data data;
+	const int signals[] = { stage->signal, SIGINVALID };
+
+	if (event_loop.tree_fd >= 0)
+		scan_tree();
+
+	data.target_state = STATE_UNMODIFIED;
+	data.d.signal = signals;
+	a_flagged_each(&waitproc_options.pids, signal, trace_data_init(&data));
+	waitproc_flags_setif(WAITPROC_FLAG_ERROROCCURED, data.error_occured);
+}
+
+
+/*
+ * Runs all schedule stages that are due and arms the timer for the next stage
+ * or the end of the waiting period, whichever comes first. All offsets are
+ * relative to the same start time. With --writers-first, the writers go first
+ * and follow their own offsets (see writer_offset_ms()).
+ */
+void run_schedule()
+{
+	const struct schedule *schedule = &waitproc_options.schedule;
+	const bool writers_first = waitproc_flags_test(WAITPROC_FLAG_WRITERS_FIRST);
+	const struct schedule_stage *stage;
+	struct timespec now;
+	struct itimerspec timer;
+	long elapsed_ms, deadline_ms = -1;
+
+	verify(clock_gettime(CLOCK_MONOTONIC, &now) == 0);
+	elapsed_ms = (long)(timespec_subtract(&now, &waitproc_options.wait_start) * 1e3);
+
+	while (writers_first && event_loop.next_writer_stage < schedule->length &&
+		writer_offset_ms(event_loop.next_writer_stage) <= elapsed_ms
+	) {
+		run_stage(&schedule->stages[event_loop.next_writer_stage++], &signal_writer);
+	}
+	while (event_loop.next_stage < schedule->length &&
+		schedule->stages[event_loop.next_stage].offset_ms <= elapsed_ms
+	) {
+		stage = &schedule->stages[event_loop.next_stage++];
+		run_stage(stage, &signal_other);
+		signal_cgroups(stage->signal);
+	}
+
+	if (waitproc_options.interval_ms && elapsed_ms >= waitproc_options.interval_ms) {
+		event_loop.expired = true;
+		return;
+	}
+
+	if (event_loop.next_stage < schedule->length)
+		deadline_ms = schedule->stages[event_loop.next_stage].offset_ms;
+	if (writers_first && event_loop.next_writer_stage < schedule->length &&
+		(deadline_ms < 0 || writer_offset_ms(event_loop.next_writer_stage) < deadline_ms))
+	{
+		deadline_ms = writer_offset_ms(event_loop.next_writer_stage);
+	}
+	if (waitproc_options.interval_ms && (deadline_ms < 0 || waitproc_options.interval_ms < deadline_ms))
+		deadline_ms = waitproc_options.interval_ms;
+
+	memset(&timer, 0, sizeof(timer));
+	if (deadline_ms >= 0) {
+		timer.it_value = waitproc_options.wait_start;
+		timespec_add_ms(&timer.it_value, deadline_ms);
+	}
+	verify(timerfd_settime(event_loop.timer_fd, TFD_TIMER_ABSTIME, &timer, NULL) == 0);
+}
+
+
+void start_timer()
+{
+	assert(timespec_iszero(&waitproc_options.wait_start));
+
+	if (waitproc_flags_test(WAITPROC_FLAG_WRITERS_FIRST))
+		find_writers();
+	verify(clock_gettime(CLOCK_MONOTONIC, &waitproc_options.wait_start) == 0);
+	run_schedule();
+}
+
+
+static inline
+bool is_stop_signal(int signal)
+{
+	return signal == SIGSTOP || signal == SIGTSTP || signal == SIGTTIN || signal == SIGTTOU;
+}
+
+
+/*
+ * Handles a status change of a seized process. While waiting, stop signals are
+ * replaced with SIGCONT so the process can go on to terminate and other
+ * signals are forwarded. While detaching, the first stop of a process detaches
+ * it and passes on the signal it stopped for, if any.
+ */
+void handle_wait(pid_t pid, int status)
+{
+	struct flagged_int *p = get_flagged_int(&waitproc_options.pids, pid);
+	unsigned long child;
+
+	// new children may report before their parent's fork event
+	if (!p) {
+		assert(waitproc_flags_test(WAITPROC_FLAG_TREE));
+		if (!(p = track_child(pid)))
+			return;
+	}
+
+	if (WIFSTOPPED(status)) {
+		const int event = status >> 16;
+		long r = event ? 0 : WSTOPSIG(status);
+		assert(p->valid && p->state == STATE_CONTINUED);
+
+		if ((event == PTRACE_EVENT_FORK || event == PTRACE_EVENT_VFORK) &&
+			ptrace(PTRACE_GETEVENTMSG, pid, 0, &child) == 0)
+		{
+			track_child((pid_t) child);
+			p = get_flagged_int(&waitproc_options.pids, pid);
+		}
+
+		if (event_loop.detaching) {
+			r = ptrace(PTRACE_DETACH, pid, 0, r);
+			if (r != 0 && errno != ESRCH) {
+				perror("ptrace detach");
+				waitproc_flags_set(WAITPROC_FLAG_ERROROCCURED);
+			}
+			p->state = STATE_DETACHED;
+			note_event(p, PROCESS_DETACHED, 0);
+			event_loop.detaching--;
+			return;
+		}
+
+		if (event == PTRACE_EVENT_STOP && is_stop_signal(WSTOPSIG(status))) {
+			// a group-stop: one SIGCONT resumes all threads, traced or not
+			note_event(p, PROCESS_STOPPED, WSTOPSIG(status));
+			kill(pid, SIGCONT);
+		} else if (is_stop_signal((int) r)) {
+			note_event(p, PROCESS_STOPPED, (int) r);
+			r = SIGCONT;
+		} else if (r) {
+			note_event(p, PROCESS_FORWARDED, (int) r);
+		}
+		r = ptrace(PTRACE_CONT, pid, 0, r);
+		assert(r == 0 || errno == ESRCH);
+	} else if (WIFEXITED(status) || WIFSIGNALED(status)) {
+		assert(p->valid && p->state < STATE_TERMINATED);
+		p->state = STATE_TERMINATED;
+		p->valid = false;
+		note_event(p, PROCESS_EXITED, status);
+		event_loop.terminated++;
+		if (event_loop.detaching)
+			event_loop.detaching--;
+	}
+}
+
+
+/*
+ * Attaches to the processes again that the kernel dropped (see
+ * reattach_process()) and checks again later while a dropped one may be on
+ * its way.
+ */
+void check_tracees()
+{
+	struct itimerspec timer;
+	struct trace_data data;
+
+	a_flagged_each(&waitproc_options.pids, &reattach_process, trace_data_init(&data));
+	waitproc_flags_setif(WAITPROC_FLAG_ERROROCCURED, data.error_occured);
+
+	if (data.pending && event_loop.tracees_fd >= 0) {
+		memset(&timer, 0, sizeof(timer));
+		timer.it_value.tv_sec = event_loop.tracees_check_ms / 1000;
+		timer.it_value.tv_nsec = event_loop.tracees_check_ms % 1000 * 1000000L;
+		verify(timerfd_settime(event_loop.tracees_fd, 0, &timer, NULL) == 0);
+		event_loop.tracees_check_ms = min(event_loop.tracees_check_ms * 2, TRACEES_CHECK_MAX_MS);
+	}
+}
+
+
+void reap_children()
+{
+	bool reaped = false;
+	pid_t pid;
+	int status;
+
+	// only the thread group leaders are traced, but they need not be our children
+	while ((pid = waitpid(-1, &status, WUNTRACED | WNOHANG | __WALL)) > 0) {
+		handle_wait(pid, status);
+		reaped = true;
+	}
+
+	if (pid == 0 && !reaped && !event_loop.detaching) {
+		// a SIGCHLD without news may come from a leader that gets dropped
+		event_loop.tracees_check_ms = TRACEES_CHECK_MIN_MS;
+		check_tracees();
+	}
+
+	if (pid < 0) switch (errno) {
+		case ECHILD:
+			if (event_loop.detaching) {
+				event_loop.detaching = 0;
+			} else {
+				check_tracees();
+			}
+			break;
+
+		default:
+			UNEXPECTED_STATE();
+			break;
+	}
+}
+
+
+/*
+ * Returns the wait status of an exited process that its parent hasn't reaped
+ * yet, or -1. The pidfd tells whether the status really belongs to pid.
+ */
+int pidfd_exit_status(pid_t pid, int pidfd)
+{
+	char path[48], buf[1024], *s;
+	FILE *f;
+	int status = -1, field, fdinfo_pid = -1;
+	size_t n;
+
+	snprintf(path, sizeof(path), "/proc/%i/stat", pid);
+	if (!(f = fopen(path, "r")))
+		return -1;
+	n = fread(buf, 1, sizeof(buf) - 1, f);
+	fclose(f);
+	buf[n] = '\0';
+
+	// the exit code is field 52; the command name (field 2) may contain spaces
+	if ((s = strrchr(buf, ')'))) {
+		for (field = 2; s && field < 52; field++)
+			s = strchr(s + 1, ' ');
+		if (!s || sscanf(s, "%i", &status) != 1)
+			status = -1;
+	}
+
+	// a reaped process' pidfd reports PID -1
+	snprintf(path, sizeof(path), "/proc/self/fdinfo/%i", pidfd);
+	if (status >= 0 && (f = fopen(path, "r"))) {
+		while (fgets(buf, sizeof(buf), f) && sscanf(buf, "Pid: %i", &fdinfo_pid) != 1)
+			;
+		fclose(f);
+	}
+	return (fdinfo_pid == pid) ? status : -1;
+}
+
+
+void handle_process_exit(pid_t pid)
+{
+	struct flagged_int *p = get_flagged_int(&waitproc_options.pids, pid);
+	assert(p && p->fd >= 0);
+
+	if (p->state < STATE_TERMINATED) {
+		int status = waitproc_options.stats_path ? pidfd_exit_status(pid, p->fd) : -1;
+		verify(epoll_ctl(event_loop.epoll_fd, EPOLL_CTL_DEL, p->fd, NULL) == 0);
+		close(p->fd);
+		p->fd = -1;
+		p->state = STATE_TERMINATED;
+		p->valid = false;
+		note_event(p, PROCESS_EXITED, status);
+		event_loop.terminated++;
+	}
+}
+
+
+void handle_cgroup_event(size_t index)
+{
+	struct cgroup *c = &waitproc_options.cgroups.values[index];
+	assert(index < waitproc_options.cgroups.length && c->events_fd >= 0);
+
+	if (cgroup_update(c) != 0) {
+		warn("%s", c->path);
+		waitproc_flags_set(WAITPROC_FLAG_ERROROCCURED);
+		c->populated = false;
+	}
+	if (!c->populated) {
+		verify(epoll_ctl(event_loop.epoll_fd, EPOLL_CTL_DEL, c->events_fd, NULL) == 0);
+		cgroup_close(c);
+		print_terminated_cgroup(c);
+		event_loop.terminated++;
+	}
+}
+
+
+void handle_signals()
+{
+	struct signalfd_siginfo info;
+	bool child = false;
+
+	while (read(event_loop.signal_fd, &info, sizeof(info)) == sizeof(info)) {
+		switch (info.ssi_signo) {
+			case SIGCHLD:
+				child = true;
+				break;
+
+			default:
+				// asked to quit: stop waiting and let go of the processes, even with -k
+				waitproc_flags_set(WAITPROC_FLAG_ABORTED);
+				event_loop.expired = true;
+				break;
+		}
+	}
+
+	if (child)
+		reap_children();
+}
+
+
+void run_event_loop()
+{
+	struct epoll_event events[64], *e;
+	uint64_t expirations;
+	int n;
+
+	while (!event_loop.expired && !is_done()) {
+		n = epoll_wait(event_loop.epoll_fd, events, (int) elementsof(events), -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			waitproc_flags_set(WAITPROC_FLAG_ERROROCCURED);
+			break;
+		}
+
+		for (e = events; e != events + n; e++) {
+			switch (event_data_source(e->data.u64)) {
+				case EVENT_PROCESS:
+					handle_process_exit(event_data_pid(e->data.u64));
+					break;
+
+				case EVENT_TIMER:
+					if (read(event_loop.timer_fd, &expirations, sizeof(expirations)) > 0)
+						run_schedule();
+					break;
+
+				case EVENT_SIGNAL:
+					handle_signals();
+					break;
+
+				case EVENT_CGROUP:
+					handle_cgroup_event((size_t) event_data_pid(e->data.u64));
+					break;
+
+				case EVENT_TREE:
+					if (read(event_loop.tree_fd, &expirations, sizeof(expirations)) > 0)
+						scan_tree();
+					break;
+
+				case EVENT_INPUT:
+					read_input();
+					break;
+
+				case EVENT_WATCH:
+					read_watch();
+					break;
+
+				case EVENT_TRACEES:
+					if (read(event_loop.tracees_fd, &expirations, sizeof(expirations)) > 0)
+						check_tracees();
+					break;
+
+				case EVENT_STUCK:
+					if (read(event_loop.stuck_fd, &expirations, sizeof(expirations)) > 0)
+						scan_stuck();
+					break;
+			}
+		}
+	}
+}
+
+
+/*
+ * Waits up to DETACH_TIMEOUT_MS for the interrupted processes to stop and
+ * detaches them. The kernel detaches any stragglers when we exit.
+ */
+void await_detach(int count)
+{
+	const struct itimerspec disarm = { { 0, 0 }, { 0, 0 } };
+	int *const periodic[] = { &event_loop.watch_fd, &event_loop.tracees_fd, &event_loop.stuck_fd };
+	int *const *fd;
+	struct epoll_event event;
+	uint64_t expirations;
+
+	// or they keep epoll_wait() from timing out
+	verify(timerfd_settime(event_loop.timer_fd, 0, &disarm, NULL) == 0);
+	for (fd = periodic; fd != array_end(periodic); fd++) {
+		if (**fd >= 0) {
+			close(**fd);
+			**fd = -1;
+		}
+	}
+	event_loop.detaching = count;
+	reap_children();
+
+	while (event_loop.detaching > 0 &&
+		epoll_wait(event_loop.epoll_fd, &event, 1, DETACH_TIMEOUT_MS) > 0
+	) {
+		if (event_data_source(event.data.u64) == EVENT_SIGNAL)
+			handle_signals();
+		else if (event_data_source(event.data.u64) == EVENT_TIMER)
+			read(event_loop.timer_fd, &expirations, sizeof(expirations));
+	}
+}
+
+
+int wait_pids_ptrace()
+{
+	struct trace_data data;
+	int terminated;
+
+	if (!event_loop_init(true)) {
+		waitproc_flags_set(WAITPROC_FLAG_ERROROCCURED);
+		event_loop_free();
+		return 0;
+	}
+
+	data.d.ptrace_options = waitproc_flags_test(WAITPROC_FLAG_TREE) ?
+		PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK : 0;
+	event_loop.attach = &attach_process;
+	event_loop.ptrace_options = data.d.ptrace_options;
+	a_flagged_each(&waitproc_options.pids, &attach_process, trace_data_init(&data));
+	waitproc_flags_setif(WAITPROC_FLAG_ERROROCCURED, data.error_occured);
+	event_loop.count = data.count;
+	if (waitproc_flags_test(WAITPROC_FLAG_TREE))
+		event_loop.count += attach_descendants(&data);
+	event_loop.count += open_cgroups();
+	if (waitproc_flags_test(WAITPROC_FLAG_STDIN))
+		start_input();
+	if (waitproc_flags_test(WAITPROC_FLAG_WATCH_MOUNT) && !start_watch())
+		waitproc_flags_set(WAITPROC_FLAG_ERROROCCURED);
+	if (waitproc_options.stuck_ms && !start_stuck_scan())
+		waitproc_flags_set(WAITPROC_FLAG_ERROROCCURED);
+	if (event_loop.count <= 0 && !event_loop.input_open && event_loop.watch_fd < 0 &&
+		!waitproc_flags_test(WAITPROC_FLAG_INDEXED))
+	{
+		event_loop_free();
+		return event_loop.count;
+	}
+
+	start_timer();
+	run_event_loop();
+	terminated = event_loop.terminated;
+
+	if (waitproc_flags_test(WAITPROC_FLAG_KILL) && !waitproc_flags_test(WAITPROC_FLAG_ABORTED)) {
+		data.target_state = STATE_TERMINATED;
+		terminated = event_loop.count;
+	} else {
+		data.target_state = STATE_DETACHED;
+	}
+	a_flagged_each(&waitproc_options.pids, &detach_process, trace_data_init(&data));
+	waitproc_flags_setif(WAITPROC_FLAG_ERROROCCURED, data.error_occured);
+	release_cgroups(data.target_state == STATE_TERMINATED);
+	if (data.target_state == STATE_DETACHED)
+		await_detach(data.count);
+
+	event_loop_free();
+	return terminated;
+}
+
+
+/*
+ * Returns the amount of terminated processes like wait_pids_ptrace() or -1 if
+ * the kernel doesn't support pidfds.
+ */
+int wait_pids_pidfd()
+{
+	struct trace_data data;
+	int terminated;
+
+	raise_nofile_limit();
+	if (!event_loop_init(false)) {
+		waitproc_flags_set(WAITPROC_FLAG_ERROROCCURED);
+		event_loop_free();
+		return 0;
+	}
+
+	a_flagged_each(&waitproc_options.pids, &open_process, trace_data_init(&data));
+	if (!waitproc_options.pids.length && waitproc_flags_test(WAITPROC_FLAG_STDIN)) {
+		// nothing told us yet whether pidfds work
+		int fd = sys_pidfd_open(getpid(), 0);
+		if (fd >= 0)
+			close(fd);
+		else
+			data.unsupported = errno == ENOSYS;
+	}
+	if (data.unsupported) {
+		assert(data.count == 0);
+		event_loop_free();
+		return -1;
+	}
+	waitproc_flags_setif(WAITPROC_FLAG_ERROROCCURED, data.error_occured);
+	event_loop.count = data.count;
+	event_loop.attach = &open_process;
+	event_loop.ptrace_options = 0;
+	if (waitproc_flags_test(WAITPROC_FLAG_TREE)) {
+		event_loop.count += attach_descendants(&data);
+		if (!start_tree_scan())
+			waitproc_flags_set(WAITPROC_FLAG_ERROROCCURED);
+	}
+	event_loop.count += open_cgroups();
+	if (waitproc_flags_test(WAITPROC_FLAG_STDIN))
+		start_input();
+	if (waitproc_flags_test(WAITPROC_FLAG_WATCH_MOUNT) && !start_watch())
+		waitproc_flags_set(WAITPROC_FLAG_ERROROCCURED);
+	if (waitproc_options.stuck_ms && !start_stuck_scan())
+		waitproc_flags_set(WAITPROC_FLAG_ERROROCCURED);
+
+	start_timer();
+	run_event_loop();
+	terminated = event_loop.terminated;
+
+	if (waitproc_flags_test(WAITPROC_FLAG_KILL) && !waitproc_flags_test(WAITPROC_FLAG_ABORTED)) {
+		data.target_state = STATE_TERMINATED;
+		terminated = event_loop.count;
+	} else {
+		data.target_state = STATE_DETACHED;
+	}
+	a_flagged_each(&waitproc_options.pids, &release_process, trace_data_init(&data));
+	waitproc_flags_setif(WAITPROC_FLAG_ERROROCCURED, data.error_occured);
+	release_cgroups(data.target_state == STATE_TERMINATED);
+
+	event_loop_free();
+	return terminated;
+}
+
+
+int wait_pids()
+{
+	if (!waitproc_flags_test(WAITPROC_FLAG_PTRACE)) {
+		int r;
+		waitproc_options.run.engine = "pidfd";
+		if ((r = wait_pids_pidfd()) >= 0)
+			return r;
+	}
+	waitproc_options.run.engine = "ptrace";
+	return wait_pids_ptrace();
+}
+
+
+void write_stats()
+{
+	FILE *f = streq1(waitproc_options.stats_path, '-') ?
+		stdout : fopen(waitproc_options.stats_path, "w");
+
+	waitproc_options.run.interval_ms = waitproc_options.interval_ms;
+	if (!f || !stats_write(f, &waitproc_options.run, &waitproc_options.pids) ||
+		(f != stdout && fclose(f) != 0)
+	) {
+		warn("%s", waitproc_options.stats_path);
+		waitproc_flags_set(WAITPROC_FLAG_ERROROCCURED);
+	}
+}
+
+
+int parse_pids(unsigned int argc, char *argv[])
+{
+	unsigned int argp;
+	int pid;
+
+	for (argp = 0; argp < argc; argp++) {
+		if (parse_pid(argv[argp], &pid)) {
+			push_flagged_int(&waitproc_options.pids, pid, true);
+		}
+	}
+
+	return (int) min(waitproc_options.pids.length, (size_t)INT_MAX);
+}
+
+
+/*
+ * Pushes the processes that use the mount points. Their devices stay around
+ * for --watch-mount.
+ */
+int find_mount_blockers()
+{
+	dev_t *devices;
+	unsigned int i, count = 0, tracked = 0;
+	ssize_t r = 0, n = 0;
+
+	if (!a_flagged_int_init(&waitproc_options.pids, 0) ||
+		!(devices = malloc(waitproc_options.mount_point_count * sizeof(*devices)))
+	) {
+		perror("malloc");
+		waitproc_flags_set(WAITPROC_FLAG_ERROROCCURED);
+		return -1;
+	}
+
+	for (i = 0; i < waitproc_options.mount_point_count; i++) {
+		const char *path = waitproc_options.mount_points[i];
+		if (mount_device(path, &devices[count]) == 0) {
+			count++;
+		} else {
+			if (errno == EINVAL) {
+				warnx("%s is not a mount point.", path);
+			} else {
+				warn("%s", path);
+			}
+			waitproc_flags_set(WAITPROC_FLAG_ERROROCCURED);
+		}
+	}
+
+	// the devices the daemon tracks go to the front
+	for (i = 0; i < count; i++) {
+		if (tracker_covers(devices[i])) {
+			dev_t d = devices[tracked];
+			devices[tracked++] = devices[i];
+			devices[i] = d;
+		}
+	}
+
+	// the index misses processes that never opened anything there, e. g. a
+	// shell that just changed into it; is_done() scans /proc for them at the end
+	if (tracked && (r = tracker_blockers(devices, tracked, &waitproc_options.pids)) > 0) {
+		waitproc_flags_set(WAITPROC_FLAG_INDEXED);
+	} else if (tracked) {
+		if (r < 0)
+			perror("Looking up the tracked processes");
+		r = 0;
+		tracked = 0;
+	}
+	if (count > tracked && (n = procscan(devices + tracked, count - tracked, &waitproc_options.pids, 0)) < 0) {
+		perror("Scanning /proc");
+		waitproc_flags_set(WAITPROC_FLAG_ERROROCCURED);
+	}
+	r = (r < 0 || n < 0) ? -1 : (ssize_t) waitproc_options.pids.length;
+
+	waitproc_options.devices = devices;
+	waitproc_options.device_count = count;
+	return (int) min(r, INT_MAX);
+}
+
+
+enum waitproc_option_keys {
+	OPTION_STATS = 0x100,
+	OPTION_CGROUP,
+	OPTION_TREE,
+	OPTION_DAEMON,
+	OPTION_CONNECT,
+	OPTION_STDIN,
+	OPTION_WATCH_MOUNT,
+	OPTION_WRITERS_FIRST,
+	OPTION_DEADLINE,
+	OPTION_FORMAT,
+	OPTION_STUCK,
+	OPTION_EXIT_STUCK
+};
+
+
+int parse_schedule(int key, const char *arg, struct argp_state *state, void *data)
+{
+	UNUSED(key); UNUSED(data);
+
+	if (schedule_parse(&waitproc_options.schedule, arg) != 0) {
+		argp_error(state, "'%s' is not a valid schedule because \"%s\".", arg,
+			(errno == EINVAL) ? "Parse error" : strerror(errno));
+		return EINVAL;
+	}
+	return 0;
+}
+
+
+int parse_format(int key, const char *arg, struct argp_state *state, void *data)
+{
+	UNUSED(key); UNUSED(data);
+
+	if (streq(arg, "ndjson")) {
+		waitproc_flags_set(WAITPROC_FLAG_NDJSON);
+	} else if (streq(arg, "plain")) {
+		waitproc_flags_unset(WAITPROC_FLAG_NDJSON);
+	} else {
+		argp_error(state, "'%s' is not a known output format.", arg);
+		return EINVAL;
+	}
+	return 0;
+}
+
+
+int parse_cgroup(int key, const char *arg, struct argp_state *state, void *data)
+{
+	UNUSED(key); UNUSED(data);
+
+	if (!a_cgroup_push(&waitproc_options.cgroups, arg)) {
+		argp_failure(state, EXIT_FAILURE, errno, "%s", arg);
+		return errno;
+	}
+	return 0;
+}
+
+
+int parse_options(int key, char *arg, struct argp_state *state)
+{
+	int r;
+
+	if ((r = argp_action_wrapper(key, arg, state)) != ARGP_ERR_UNKNOWN) {
+		const long *period = NULL;
+		switch (key) {
+		case 'i':
+			period = &waitproc_options.interval_ms;
+			break;
+		case OPTION_DEADLINE:
+			period = &waitproc_options.deadline_ms;
+			break;
+		case OPTION_STUCK:
+			period = &waitproc_options.stuck_ms;
+			break;
+		}
+		if (period && (r == EINVAL || *period <= 0)) {
+			argp_error(state, "'%s' is not a positive time period.", arg);
+			return EINVAL;
+		}
+		return r;
 	}
 
 	switch (key) {
 	case ARGP_KEY_ARG: {
 		unsigned int remainig_argc = (unsigned int)(state->argc - state->next + 1);
+		if (waitproc_flags_test(WAITPROC_FLAG_MOUNT)) {
+			waitproc_options.mount_points = &state->argv[state->next-1];
+			waitproc_options.mount_point_count = remainig_argc;
+			state->next = state->argc;
+			return 0;
+		}
 		a_flagged_int_init(&waitproc_options.pids, remainig_argc);
 		if (parse_pids(remainig_argc, &state->argv[state->next-1]) > 0) {
 			state->next = state->argc;
@@ -431,6 +2066,11 @@ int parse_options(int key, char *arg, struct argp_state *state)
 	}
 
 	case ARGP_KEY_NO_ARGS:
+		if (waitproc_options.cgroups.length || waitproc_options.daemon_path ||
+			waitproc_flags_test(WAITPROC_FLAG_STDIN) || waitproc_flags_test(WAITPROC_FLAG_DISMOUNT))
+		{
+			return 0;
+		}
 		argp_usage(state);
 		// don't return or fall through
 
@@ -443,10 +2083,11 @@ int parse_options(int key, char *arg, struct argp_state *state)
 static struct argp_option const argp_options[] = {
 	{ "interval",		'i', "INTERVAL", 0,
 		"Wait no longer than INTERVAL for the PIDs to finish. "
-		"The letters w, d, h, m, and s may be used to express an interval "
-		"in weeks, days, hours, minutes, or seconds respectively. Multiple "
-		"such expressions may be used in that order to add their intervals. "
-		"The default is to use seconds.",
+		"The suffixes w, d, h, m, s, and ms may be used to express an interval "
+		"in weeks, days, hours, minutes, seconds, or milliseconds respectively. "
+		"Multiple such expressions may be used in that order to add their "
+		"intervals, and each number may have a decimal fraction, e. g. 1.5s or "
+		"1s500ms. The default is to use seconds.",
 		0 },
 
 	{ "disjunctive",	'd', NULL, 0,
@@ -455,11 +2096,52 @@ static struct argp_option const argp_options[] = {
 		0 },
 
 	{ "terminate",		't', NULL, 0,
-		"Send SIGTERM to each PID before waiting for them to terminate.",
+		"Send SIGTERM to each PID before waiting for them to terminate. "
+		"Same as --schedule HUP,TERM.",
+		0 },
+
+	{ "schedule",		's', "SCHEDULE", 0,
+		"Send signals to the PIDs still running at the given offsets from the "
+		"start of the waiting period. SCHEDULE is a comma-separated list of "
+		"stages SIGNAL[@OFFSET], e. g. TERM@0,INT@500ms,KILL@3s. Signals may "
+		"be given by name or number, offsets like INTERVAL. May be given "
+		"multiple times.",
 		0 },
 
 	{ "kill", 			'k', NULL, 0,
-		"Send SIGKILL to each PID still running after INTERVAL.",
+		"Send SIGKILL to each PID still running after INTERVAL. SIGINT or "
+		"SIGTERM stop the waiting early without killing anybody; we fail then.",
+		0 },
+
+	{ "deadline",		OPTION_DEADLINE, "PERIOD", 0,
+		"Finish within PERIOD (like INTERVAL) from the start, whatever came "
+		"before the waiting. The waiting period is cut to what's left, and the "
+		"stages of the schedule move closer together to still fit in; with "
+		"nothing left, they all run right away. tc-dismount keeps up to a second "
+		"of it to unmount and remove the volumes, and gives up on those that "
+		"are still busy then.",
+		0 },
+
+	{ "stuck",			OPTION_STUCK, "PERIOD", 0,
+		"Report the PIDs with a thread that stays in uninterruptible sleep (D "
+		"state) for PERIOD (like INTERVAL), e. g. in I/O on a dead device, with "
+		"the kernel function it waits in, on stderr (or as stuck events with "
+		"--format=ndjson). "
+		"Signals, even SIGKILL, don't get through to them until it returns. "
+		"We look every 250 ms (or PERIOD if shorter).",
+		0 },
+
+	{ "exit-stuck",		OPTION_EXIT_STUCK, NULL, 0,
+		"With --stuck, stop waiting once only stuck PIDs are left (and no "
+		"cgroups or input), and exit with status 3 afterwards. -k still kills "
+		"them, for when they come back. tc-dismount goes straight to "
+		"`veracrypt -d --force` for the volumes they block.",
+		0 },
+
+	{ "jobs",			'j', "JOBS", 0,
+		"tc-dismount removes the mappings of up to JOBS volumes at once, each "
+		"with its own retries and VeraCrypt fallback. The default, 0, is all of "
+		"them.",
 		0 },
 
 	{ "quiet", 			'q', NULL, 0,
@@ -467,23 +2149,117 @@ static struct argp_option const argp_options[] = {
 		"we immediately print a line with that PID.",
 		0 },
 
+	{ "format",			OPTION_FORMAT, "FORMAT", 0,
+		"Print the events on stdout in FORMAT: \"plain\" (the default) prints "
+		"the PIDs that terminate (and the emptied cgroups); \"ndjson\" prints a "
+		"JSON object per line for every transition of a PID: attached, "
+		"signalled, stopped (a stop signal intercepted with ptrace), forwarded "
+		"(another signal passed on with ptrace), exited (with exit_code or "
+		"exit_signal if known), killed, vanished, and detached, as well as "
+		"emptied for cgroups. Each has the wall-clock time, elapsed_ms since "
+		"the start, and the pid, signal, or cgroup, and is flushed right away.",
+		0 },
+
+	{ "mount", 			'm', NULL, 0,
+		"Treat the arguments as mount points and wait for all processes that "
+		"use the mounted file systems, i. e. that have files on them open or "
+		"mapped, or their working or root directory there.",
+		0 },
+
+	{ "watch-mount",	OPTION_WATCH_MOUNT, NULL, 0,
+		"Like --mount, but keep watching the mount points while we wait: "
+		"processes that start using them join the others and get the signals "
+		"that these got already. We only finish early once a final scan finds "
+		"the mounts idle. As root, fanotify reports the processes opening files "
+		"there; otherwise we scan every 250 ms.",
+		0 },
+
+	{ "stdin",			OPTION_STDIN, NULL, 0,
+		"Also read PIDs from stdin, separated by white space, until the end of "
+		"the input. We attach to each as soon as it arrives and send it the "
+		"signals that the others got already, so the discovery of the PIDs may "
+		"still be running while we wait.",
+		0 },
+
+	{ "null",			'0', NULL, 0,
+		"The PIDs on stdin are separated by NUL characters instead.",
+		0 },
+
+	{ "tree",			OPTION_TREE, NULL, 0,
+		"Also wait for the descendants of the PIDs, including those they create "
+		"while we wait, and signal them alongside; those that turn up late get "
+		"the signals that the others got already. With ptrace, new processes "
+		"are reported by the kernel; with pidfds, we look for them every "
+		"100 ms and before each signal, so a process whose parent exits "
+		"right after creating it may escape.",
+		0 },
+
+	{ "writers-first",	OPTION_WRITERS_FIRST, NULL, 0,
+		"Give the PIDs with regular files open for writing (on the mount points "
+		"with --mount) a larger share of the grace period: they get the signals "
+		"at the start of the schedule first, and each later stage only halfway "
+		"to the next one (or to the end of INTERVAL). The PIDs are split into "
+		"writers and others before the first signal, and those that turn up "
+		"later as they come. Their flushing then overlaps with the "
+		"shutdown of the others instead of being cut short.",
+		0 },
+
+	{ "cgroup",			OPTION_CGROUP, "PATH", 0,
+		"Also wait for the cgroup v2 at PATH (relative to the cgroup2 mount "
+		"point unless absolute) to become empty. The group is frozen while "
+		"the processes in it and its descendants are signalled, so forks "
+		"can't escape; SIGKILL goes through cgroup.kill. May be given "
+		"multiple times; the PIDs are optional then.",
+		0 },
+
+	{ "stats",			OPTION_STATS, "FILE", 0,
+		"Write a JSON document to FILE with the attach, signal, and exit times "
+		"of every PID, how it ended, and histograms of the attach and "
+		"termination latencies.",
+		0 },
+
+	{ "ptrace", 		'p', NULL, 0,
+		"Use ptrace() to wait for the PIDs even if the kernel supports pidfds.",
+		0 },
+
+	{ "daemon",			OPTION_DAEMON, "SOCKET", 0,
+		"Don't wait for anything, but listen on the Unix socket SOCKET and run "
+		"the requests of --connect until SIGINT or SIGTERM. As root, the daemon "
+		"also keeps track of the processes that open files on the mounted "
+		"TrueCrypt volumes, so --mount can start with them and scans /proc "
+		"only once they're gone, for those that never opened anything there.",
+		0 },
+
+	{ "connect",		OPTION_CONNECT, "SOCKET", 0,
+		"Let the daemon listening on SOCKET do the job with the other options "
+		"and arguments. Its output goes to our stdout and stderr, and we exit "
+		"with its status. Without a daemon we do the job ourselves.",
+		0 },
+
 	{ 0 }
 };
 
 static struct argp const argp = {
 	argp_options, &parse_options,
 
-	"PID...",
+	"PID...\n"
+	"--mount|--watch-mount MOUNTPOINT...\n"
+	"--cgroup PATH [PID...]\n"
+	"--stdin [PID...]\n"
+	"--daemon SOCKET",
 	"waitproc waits for a set of processes, each specified by its PID, to terminate. "
 	"It can limit the waiting period, ask these processes to terminate, and even "
 	"kill them if necessary."
 	"\v"
 	"waitproc does not need to poll to determine, if a process is still alive. "
-	"Instead it hooks into it with ptrace() and waits for it to terminate. "
+	"Instead it obtains a pidfd for each of them and waits for these to signal "
+	"the termination. Signals are sent through the same pidfds, so a recycled PID "
+	"never receives a signal meant for its predecessor.\n"
+	"On kernels without pidfd support (before Linux 5.3) or with --ptrace, "
+	"waitproc hooks into the processes with ptrace() instead. "
 	"As a consequence the parents of these processes cannot wait() for them anymore "
-	"as long as we wait for them. If --terminate or --kill are in effect, "
-	"SIGSTOP and SIGTSTP are intercepted and dropped. All other signals are "
-	"forwarded.\n"
+	"as long as we wait for them. Stop signals (SIGSTOP, SIGTSTP, SIGTTIN, "
+	"SIGTTOU) are intercepted and dropped; all other signals are forwarded. "
 	"Depending on your system configuration, only root might be able to ptrace "
 	"for security reasons. An attacker might use ptrace (and therefore waitproc) "
 	"to prevent a process parent from waiting for it itself.",
@@ -491,34 +2267,236 @@ static struct argp const argp = {
 	NULL, NULL, NULL
 };
 
+static struct argp const dismount_argp = {
+	argp_options, &parse_options,
+
+	"[VOLUME...]",
+	"tc-dismount dismounts the TrueCrypt and VeraCrypt volumes, each specified by "
+	"the volume, its mapper device, or its mount point, or all of them. It "
+	"unmounts the volumes that nobody uses right away, waits for the processes "
+	"using the others like waitproc --watch-mount with the given options, and "
+	"then removes the mappings of the unmounted volumes."
+	"\v"
+	"The waiting covers all busy volumes at once; the mappings are removed "
+	"concurrently (see --jobs). Mappings that device-mapper won't remove and "
+	"volumes mounted with \"nokernelcrypto\" are left to `veracrypt -d --force`.",
+
+	NULL, NULL, NULL
+};
+
 
 static struct argp_action argp_actions[] = {
 	{ 'q', ARGP_ACTION_SET_FLAG, { &waitproc_options.flags }, { 1UL << WAITPROC_FLAG_QUIET } },
 	{ 'd', ARGP_ACTION_SET_FLAG, { &waitproc_options.flags }, { 1UL << WAITPROC_FLAG_DISJUNCTIVE } },
 	{ 't', ARGP_ACTION_SET_FLAG, { &waitproc_options.flags }, { 1UL << WAITPROC_FLAG_TERMINATE } },
 	{ 'k', ARGP_ACTION_SET_FLAG, { &waitproc_options.flags }, { 1UL << WAITPROC_FLAG_KILL } },
-	{ 'i', ARGP_ACTION_PARSE, { &waitproc_options.interval_sec }, { ARGUMENT_PERIOD } },
+	{ 'm', ARGP_ACTION_SET_FLAG, { &waitproc_options.flags }, { 1UL << WAITPROC_FLAG_MOUNT } },
+	{ 'p', ARGP_ACTION_SET_FLAG, { &waitproc_options.flags }, { 1UL << WAITPROC_FLAG_PTRACE } },
+	{ 's', ARGP_ACTION_CALLBACK, { .callback = &parse_schedule }, { 0 } },
+	{ '0', ARGP_ACTION_SET_FLAG, { &waitproc_options.flags }, { 1UL << WAITPROC_FLAG_NULL } },
+	{ OPTION_WATCH_MOUNT, ARGP_ACTION_SET_FLAG, { &waitproc_options.flags }, { (1UL << WAITPROC_FLAG_MOUNT) | (1UL << WAITPROC_FLAG_WATCH_MOUNT) } },
+	{ OPTION_STUCK, ARGP_ACTION_PARSE, { &waitproc_options.stuck_ms }, { ARGUMENT_PERIOD } },
+	{ OPTION_EXIT_STUCK, ARGP_ACTION_SET_FLAG, { &waitproc_options.flags }, { 1UL << WAITPROC_FLAG_EXIT_STUCK } },
+	{ OPTION_FORMAT, ARGP_ACTION_CALLBACK, { .callback = &parse_format }, { 0 } },
+	{ OPTION_STDIN, ARGP_ACTION_SET_FLAG, { &waitproc_options.flags }, { 1UL << WAITPROC_FLAG_STDIN } },
+	{ OPTION_WRITERS_FIRST, ARGP_ACTION_SET_FLAG, { &waitproc_options.flags }, { 1UL << WAITPROC_FLAG_WRITERS_FIRST } },
+	{ OPTION_TREE, ARGP_ACTION_SET_FLAG, { &waitproc_options.flags }, { 1UL << WAITPROC_FLAG_TREE } },
+	{ OPTION_CGROUP, ARGP_ACTION_CALLBACK, { .callback = &parse_cgroup }, { 0 } },
+	{ OPTION_STATS, ARGP_ACTION_SET_ARG, { .str = &waitproc_options.stats_path }, { 0 } },
+	{ OPTION_DAEMON, ARGP_ACTION_SET_ARG, { .str = &waitproc_options.daemon_path }, { 0 } },
+	{ OPTION_CONNECT, ARGP_ACTION_SET_ARG, { .str = &waitproc_options.connect_path }, { 0 } },
+	{ 'i', ARGP_ACTION_PARSE, { &waitproc_options.interval_ms }, { ARGUMENT_PERIOD } },
+	{ 'j', ARGP_ACTION_PARSE, { &waitproc_options.jobs }, { ARGUMENT_LONG | ARGUMENT_UNSIGNED | ARGUMENT_BASE_DECIMAL } },
+	{ OPTION_DEADLINE, ARGP_ACTION_PARSE, { &waitproc_options.deadline_ms }, { ARGUMENT_PERIOD } },
 	{ 0 }
 };
 
 
-int main(int argc, char *argv[])
+void parse_arguments(int argc, char *argv[])
 {
-	int result;
+	verify(clock_gettime(CLOCK_MONOTONIC, &waitproc_options.run.start) == 0);
+	verify(clock_gettime(CLOCK_REALTIME, &waitproc_options.run.start_realtime) == 0);
+
+	argp_parse(waitproc_flags_test(WAITPROC_FLAG_DISMOUNT) ? &dismount_argp : &argp,
+		argc, argv, 0, NULL, argp_actions);
+
+	if (waitproc_options.deadline_ms) {
+		waitproc_options.deadline = waitproc_options.run.start;
+		timespec_add_ms(&waitproc_options.deadline, waitproc_options.deadline_ms);
+	}
+}
 
-	argp_parse(&argp, argc, argv, 0, NULL, argp_actions);
 
-	result = wait_pids();
-	result = (
-		result > 0 && (
-			!waitproc_flags_test(WAITPROC_FLAG_ERROROCCURED) ||
-			 waitproc_flags_test(WAITPROC_FLAG_DISJUNCTIVE)
-		))
-		?	EXIT_SUCCESS
-		:	EXIT_FAILURE;
+/*
+ * tc-dismount takes the options of waitproc, but volumes as arguments, and
+ * always watches their mount points.
+ */
+void select_command(const char *path)
+{
+	const char *name = strrchr(path, '/');
 
-	// clean up
+	if (streq(name ? name + 1 : path, "tc-dismount")) {
+		waitproc_flags_set(WAITPROC_FLAG_DISMOUNT);
+		waitproc_flags_set(WAITPROC_FLAG_MOUNT);
+		waitproc_flags_set(WAITPROC_FLAG_WATCH_MOUNT);
+	}
+}
+
+
+void free_options()
+{
 	a_flagged_int_free(&waitproc_options.pids);
+	memset(&waitproc_options.pids, 0, sizeof(waitproc_options.pids));
+	free(waitproc_options.devices);
+	waitproc_options.devices = NULL;
+	a_cgroup_free(&waitproc_options.cgroups);
+	schedule_free(&waitproc_options.schedule);
+}
+
+
+/*
+ * Cuts the waiting period to what's left of --deadline, less what tc-dismount
+ * keeps for after it, and moves the schedule stages closer together, so they
+ * all still run and -k kills in time.
+ */
+void fit_deadline()
+{
+	struct schedule_stage *stage;
+	long remaining_ms = timespec_remaining_ms(&waitproc_options.deadline);
+	const long interval_ms = waitproc_options.interval_ms;
+
+	if (remaining_ms == LONG_MAX)
+		return;
+	if (waitproc_flags_test(WAITPROC_FLAG_DISMOUNT))
+		remaining_ms -= min(DEADLINE_RESERVE_MS, waitproc_options.deadline_ms / 4);
+	// zero would mean no limit
+	remaining_ms = max(remaining_ms, 1L);
+	if (interval_ms && interval_ms <= remaining_ms)
+		return;
+
+	waitproc_options.interval_ms = remaining_ms;
+	for (stage = waitproc_options.schedule.stages;
+		stage != waitproc_options.schedule.stages + waitproc_options.schedule.length; stage++)
+	{
+		if (interval_ms)
+			stage->offset_ms = (long)((double) stage->offset_ms * (double) remaining_ms / (double) interval_ms);
+		stage->offset_ms = min(stage->offset_ms, remaining_ms);
+	}
+}
+
+
+int run_job()
+{
+	int result;
+
+	if (waitproc_flags_test(WAITPROC_FLAG_TERMINATE) && !(
+			schedule_add(&waitproc_options.schedule, SIGHUP, 0) &&
+			schedule_add(&waitproc_options.schedule, SIGTERM, 0)
+	)) {
+		err(EXIT_FAILURE, "malloc");
+	}
 
+	if (waitproc_flags_test(WAITPROC_FLAG_MOUNT) && find_mount_blockers() <= 0 &&
+		!waitproc_options.cgroups.length && !waitproc_flags_test(WAITPROC_FLAG_STDIN)
+	) {
+		// nothing uses the mount points (or we couldn't tell)
+		result = waitproc_flags_test(WAITPROC_FLAG_ERROROCCURED) ? EXIT_FAILURE : EXIT_SUCCESS;
+	} else {
+		fit_deadline();
+		result = wait_pids();
+		result = (
+			result > 0 && (
+				!waitproc_flags_test(WAITPROC_FLAG_ERROROCCURED) ||
+				 waitproc_flags_test(WAITPROC_FLAG_DISJUNCTIVE)
+			))
+			?	EXIT_SUCCESS
+			:	EXIT_FAILURE;
+	}
+
+	if (waitproc_options.stats_path) {
+		write_stats();
+		if (waitproc_flags_test(WAITPROC_FLAG_ERROROCCURED) && !waitproc_flags_test(WAITPROC_FLAG_DISJUNCTIVE))
+			result = EXIT_FAILURE;
+	}
+	if (waitproc_flags_test(WAITPROC_FLAG_STUCK))
+		result = EXIT_STUCK;
+	if (waitproc_flags_test(WAITPROC_FLAG_ABORTED))
+		result = EXIT_FAILURE;
+
+	free_options();
 	return result;
 }
+
+
+int wait_mount_blockers(char **mount_points, unsigned int count)
+{
+	int result;
+
+	waitproc_options.mount_points = mount_points;
+	waitproc_options.mount_point_count = count;
+	result = run_job();
+	return waitproc_flags_test(WAITPROC_FLAG_ABORTED) ? DISMOUNT_WAIT_ABORTED : result;
+}
+
+
+int run_dismount()
+{
+	char **specs = waitproc_options.mount_points;
+	const unsigned int spec_count = waitproc_options.mount_point_count;
+	int result;
+
+	waitproc_options.mount_points = NULL;
+	waitproc_options.mount_point_count = 0;
+	result = dismount_volumes(specs, spec_count, &wait_mount_blockers, waitproc_options.jobs,
+		&waitproc_options.deadline);
+	free_options();
+	return result;
+}
+
+
+/*
+ * Runs a request of --connect in a worker of the daemon, which starts out with
+ * the daemon's options.
+ */
+int run_request(int argc, char *argv[])
+{
+	memset(&waitproc_options, 0, sizeof(waitproc_options));
+	select_command(argv[0]);
+	parse_arguments(argc, argv);
+
+	if (waitproc_options.daemon_path) {
+		warnx("A request can't start another daemon.");
+		free_options();
+		return EXIT_FAILURE;
+	}
+	return waitproc_flags_test(WAITPROC_FLAG_DISMOUNT) ? run_dismount() : run_job();
+}
+
+
+int main(int argc, char *argv[])
+{
+	const char *name = strrchr(argv[0], '/');
+	int result;
+
+	// multi-call binary
+	name = name ? name + 1 : argv[0];
+	if (streq(name, "tc-volumes"))
+		return tc_volumes_main(argc, argv);
+
+	select_command(argv[0]);
+	parse_arguments(argc, argv);
+
+	if (waitproc_options.daemon_path) {
+		free_options();
+		return daemon_main(waitproc_options.daemon_path, &run_request);
+	}
+
+	if (waitproc_options.connect_path &&
+		(result = daemon_request(waitproc_options.connect_path, argc, argv)) >= 0)
+	{
+		free_options();
+		return result;
+	}
+
+	return waitproc_flags_test(WAITPROC_FLAG_DISMOUNT) ? run_dismount() : run_job();
+}